@@ -0,0 +1,109 @@
+#ifndef ALIGNED_H
+#define ALIGNED_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+const size_t CACHE_LINE = 64; //*< Alignment (in bytes) of every numeric buffer */
+
+/**
+ * @brief Allocator that returns cache line aligned memory
+ * @details Used so that rows of weights and outputs start on a cache line and
+ * can be loaded with aligned vector instructions
+ */
+template <class T>
+struct aligned_allocator {
+    using value_type = T;
+
+    aligned_allocator() noexcept = default;
+
+    template <class U>
+    aligned_allocator(const aligned_allocator<U>&) noexcept {}
+
+    /**
+     * @brief Allocate memory for n elements
+     * @param n Number of elements
+     */
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), align_val_t(CACHE_LINE)));
+    }
+
+    /**
+     * @brief Free memory returned by allocate
+     * @param p Pointer to the memory
+     */
+    void deallocate(T* p, size_t) noexcept {
+        ::operator delete(p, align_val_t(CACHE_LINE));
+    }
+
+    template <class U>
+    bool operator==(const aligned_allocator<U>&) const noexcept {return true;}
+
+    template <class U>
+    bool operator!=(const aligned_allocator<U>&) const noexcept {return false;}
+};
+
+/**
+ * @brief Vector whose storage is cache line aligned
+ */
+template <class T>
+using aligned_vector = vector<T, aligned_allocator<T>>;
+
+/**
+ * @brief Number of elements of type T that fit in a cache line
+ */
+template <class T>
+constexpr int cache_line_elements() {return (int)(CACHE_LINE / sizeof(T));}
+
+/**
+ * @brief Round a number of elements up to a whole number of cache lines
+ * @param count Number of elements
+ */
+template <class T>
+constexpr int padded_size(int count) {
+    return (count + cache_line_elements<T>() - 1) / cache_line_elements<T>() * cache_line_elements<T>();
+}
+
+/**
+ * @brief Non owning view of a contiguous array (like std::span)
+ */
+template <class T>
+class array_view {
+private:
+    T* values; //*< First element of the view */
+    int count; //*< Number of elements of the view */
+
+public:
+    /**
+     * @brief Constructor
+     * @param values First element
+     * @param count Number of elements
+     */
+    array_view(T* values = nullptr, int count = 0) : values(values), count(count) {}
+
+    /**
+     * @brief Constructor from any contiguous container (vector, aligned_vector...)
+     * @param container Container
+     */
+    template <class Container,
+              class = decltype(static_cast<T*>(declval<Container&>().data()))>
+    array_view(Container& container) : values(container.data()), count((int)container.size()) {}
+
+    /**
+     * @brief Conversion to a read only view
+     */
+    operator array_view<const T>() const {return array_view<const T>(values, count);}
+
+    [[nodiscard]] inline T* data() const {return values;};
+    [[nodiscard]] inline int size() const {return count;};
+    [[nodiscard]] inline bool empty() const {return count == 0;};
+    [[nodiscard]] inline T* begin() const {return values;};
+    [[nodiscard]] inline T* end() const {return values + count;};
+    inline T& operator[](int i) const {return values[i];};
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef ASYNC_READER_H
+#define ASYNC_READER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief How the files of a streamed dataset are read
+ */
+enum class io_backend {
+    stream, //*< Blocking ifstream reads */
+    pread, //*< Blocking pread calls of whole blocks (POSIX) */
+    io_uring //*< Several blocks read ahead asynchronously through io_uring (Linux, else pread) */
+};
+
+/**
+ * @brief Name of an I/O backend
+ */
+const char* io_backend_name(io_backend backend);
+
+/**
+ * @brief I/O backend from its name
+ * @param name Name (stream, pread or uring)
+ * @param backend Result
+ * @return False if the name is not known
+ */
+bool parse_io_backend(const string& name, io_backend& backend);
+
+/**
+ * @brief Sequential file reader that keeps several large aligned reads in flight
+ * @details The file is read in blocks of block_size bytes into depth aligned buffers. With
+ * io_uring the depth blocks after the current one are always being read in the background,
+ * so a read only waits if the disk is slower than the consumer. With pread (or where io_uring
+ * is not available) each block is read when it is needed. With direct I/O (O_DIRECT) the page
+ * cache is bypassed, when the file system does not support it the file is read normally
+ */
+class async_reader {
+private:
+    /**
+     * @brief Buffer of one block
+     */
+    struct block {
+        unsigned char* data; //*< Contents (block_size bytes, aligned) */
+        long long index; //*< Index of the block in the file (-1: none) */
+        long long size; //*< Bytes read (valid once done) */
+        bool pending; //*< Submitted and not completed yet */
+    };
+
+    string path; //*< Path of the file */
+    int fd; //*< File descriptor */
+    io_backend backend; //*< Backend in use (io_uring or pread) */
+    bool direct; //*< Page cache bypassed */
+    size_t block_size; //*< Bytes of each block */
+    long long file_size, position; //*< Size of the file and next byte to read */
+    unsigned char* memory; //*< Buffers of every block */
+    vector<block> blocks; //*< One buffer per block in flight, block i uses buffer i % depth */
+
+    //io_uring rings (shared with the kernel)
+    int ring_fd; //*< io_uring instance (-1: none) */
+    void* sq_ring; //*< Submission ring */
+    void* cq_ring; //*< Completion ring (can be sq_ring) */
+    void* sqes; //*< Submission entries */
+    size_t sq_ring_size, cq_ring_size, sqes_size; //*< Bytes mapped for each one */
+    unsigned *sq_tail, *sq_mask, *sq_array; //*< Submission ring fields */
+    unsigned *cq_head, *cq_tail, *cq_mask; //*< Completion ring fields */
+    void* cqes; //*< Completion entries */
+
+public:
+    /**
+     * @brief Constructor, opens the file and starts reading it
+     * @param path Path to the file
+     * @param backend io_uring or pread (stream is read with pread)
+     * @param direct Bypass the page cache (O_DIRECT)
+     * @param block_size Bytes of each read (rounded up to 4096)
+     * @param depth Blocks read ahead
+     */
+    explicit async_reader(const string& path, io_backend backend = io_backend::io_uring, bool direct = false,
+                          size_t block_size = 1 << 20, int depth = 4);
+
+    async_reader(const async_reader&) = delete;
+    async_reader& operator=(const async_reader&) = delete;
+
+    /**
+     * @brief Destructor, waits for the reads in flight and closes the file
+     */
+    ~async_reader();
+
+    /**
+     * @brief Move to a position of the file (the blocks after it start loading)
+     */
+    void seek(long long offset);
+
+    /**
+     * @brief Read the next bytes of the file
+     * @param destination Destination of the bytes
+     * @param bytes Number of bytes
+     */
+    void read(void* destination, size_t bytes);
+
+    /**
+     * @brief Get the backend in use (io_uring falls back to pread if not available)
+     */
+    [[nodiscard]] io_backend get_backend() const {return backend;};
+
+    /**
+     * @brief Check if the page cache is bypassed
+     */
+    [[nodiscard]] bool is_direct() const {return direct;};
+
+    /**
+     * @brief Check if io_uring can be used on this system
+     */
+    static bool io_uring_supported();
+
+private:
+    /**
+     * @brief Start reading a block into its buffer
+     */
+    void submit(long long index);
+
+    /**
+     * @brief Wait until a block is in its buffer
+     * @return Buffer of the block
+     */
+    const block& wait(long long index);
+
+    /**
+     * @brief Wait for every read in flight
+     */
+    void drain();
+
+    /**
+     * @brief Wait for every read in flight without throwing (for the destructor)
+     * @details Completions are only taken off the queue, failed or short reads are not retried
+     * @return False if the wait failed and reads may still be writing into the buffers
+     */
+    [[nodiscard]] bool drain_quietly() noexcept;
+
+    /**
+     * @brief Handle the next completion of io_uring (waiting for it)
+     */
+    void complete();
+
+    /**
+     * @brief Read a block with pread
+     */
+    void read_block(block& b, long long done);
+
+    /**
+     * @brief Create the io_uring rings
+     * @return False if io_uring is not available
+     */
+    bool setup_ring(int entries);
+};
+
+#endif
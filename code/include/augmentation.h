@@ -0,0 +1,97 @@
+#ifndef AUGMENTATION_H
+#define AUGMENTATION_H
+
+#include <vector>
+
+#include "aligned.h"
+#include "matrix.h"
+
+using namespace std;
+
+/**
+ * @brief Strength of each random transform of the training images (0 turns it off)
+ */
+struct augmentation {
+    int rows = 28, cols = 28; //*< Size of the images */
+    real max_shift = 0; //*< Largest shift in pixels, in each direction */
+    real max_rotation = 0; //*< Largest rotation in radians, in each direction */
+    real elastic_alpha = 0; //*< Strength of the elastic distortion in pixels (34 in Simard et al.) */
+    real elastic_sigma = 4; //*< Smoothness of the elastic distortion (standard deviation in pixels) */
+    real noise = 0; //*< Largest noise added to each pixel (in pixel values, 0 to 255) */
+
+    /**
+     * @brief Check if any transform is on
+     */
+    [[nodiscard]] bool enabled() const {
+        return max_shift > 0 || max_rotation > 0 || elastic_alpha > 0 || noise > 0;
+    };
+};
+
+/**
+ * @brief Buffers of the transforms of one thread
+ * @details Sized on the first use, reusing it performs no heap allocation
+ */
+struct augment_workspace {
+    aligned_vector<real> field, blurred; //*< Random displacements and their row-blurred version */
+    aligned_vector<real> map_x, map_y; //*< Source position of each pixel */
+    aligned_vector<real> padded; //*< Image being transformed, with a border of zeros */
+};
+
+/**
+ * @brief Random shifts, rotations, elastic distortion and noise of byte images
+ * @details Shift, rotation and elastic distortion are folded into one map from every pixel to
+ * the position it is read from (bilinear, 0 outside the image), so an image is resampled once.
+ * The elastic displacements are random fields blurred by a separable Gaussian (Simard et al.).
+ * The blur and the map are built with the axpy kernel of the selected instruction set over
+ * whole images at a time, the resampling itself is a gather and stays scalar.
+ * Each image gets its random numbers from its key alone, so the result does not depend on
+ * the threads that transform the images. The augmenter is only read, any number of
+ * threads can use it at once with their own workspaces
+ */
+class augmenter {
+private:
+    augmentation settings; //*< Transforms */
+    unsigned seed; //*< Seed of every key */
+    int radius; //*< Taps of the Gaussian at each side of the center */
+    vector<real> taps; //*< Normalised Gaussian (2 * radius + 1 taps) */
+    aligned_vector<real> grid_x, grid_y; //*< Column and row of each pixel, relative to the center */
+
+public:
+    /**
+     * @brief Constructor
+     * @param settings Transforms
+     * @param seed Seed of the random transforms
+     */
+    explicit augmenter(const augmentation& settings, unsigned seed = 1);
+
+    /**
+     * @brief Get the transforms
+     */
+    [[nodiscard]] const augmentation& get_settings() const {return settings;};
+
+    /**
+     * @brief Transform an image
+     * @param source Pixels of the image (rows * cols)
+     * @param result Transformed pixels (rows * cols, can be source)
+     * @param key Key of the random numbers (e.g. from key)
+     * @param workspace Buffers of the calling thread
+     */
+    void apply(const unsigned char* source, unsigned char* result, unsigned long long key,
+               augment_workspace& workspace) const;
+
+    /**
+     * @brief Transform every sample of a batch in place
+     * @param batch Samples, one per row
+     * @param round Round of the batch (e.g. epoch and window, see key)
+     * @param first Position of the first row in its round
+     * @param workspace Buffers of the calling thread
+     */
+    void apply(byte_matrix& batch, unsigned long long round, int first, augment_workspace& workspace) const;
+
+    /**
+     * @brief Key of the random numbers of the sample at a position of a round
+     */
+    [[nodiscard]] unsigned long long key(unsigned long long round, int position) const;
+};
+
+#endif
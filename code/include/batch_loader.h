@@ -0,0 +1,147 @@
+#ifndef BATCH_LOADER_H
+#define BATCH_LOADER_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "augmentation.h"
+#include "data_set.h"
+#include "matrix.h"
+#include "spsc_queue.h"
+
+using namespace std;
+
+/**
+ * @brief Consecutive samples of a batch ready for the network
+ */
+struct prepared_slice {
+    int first, size; //*< First sample and number of samples */
+    bool sparse; //*< Inputs taken from the sparse copy of the dataset (inputs is not filled) */
+    sparse_matrix sparse_inputs; //*< Sparse inputs (into the dataset, or into gathered when shuffled) */
+    sparse_buffer gathered; //*< Sparse samples gathered out of order */
+    byte_matrix inputs; //*< Pixels, one sample per row (scaled by the first layer) */
+    matrix expected; //*< One-hot expected outputs, one sample per row */
+    augment_workspace workspace; //*< Buffers of the random transforms of the inputs */
+};
+
+/**
+ * @brief Batch ready for the network, split in the slices of its training threads
+ */
+struct prepared_batch {
+    int start, size; //*< First sample and number of samples */
+    vector<prepared_slice> slices; //*< Slices of the batch */
+};
+
+/**
+ * @brief Loads the next batches of a dataset on background threads while the current one trains
+ * @details Each loader thread has depth slots (depth 2 is double buffering) and takes every
+ * threads-th batch, so the batches come out in order. Slots go back and forth through
+ * lock-free queues and are reused, so loading allocates nothing once every slot has been used.
+ * The threads live as long as the loader: each restart starts a pass over a dataset (e.g. a
+ * window of a stream, or an epoch in a new order) with the same threads and slots
+ */
+class batch_loader {
+private:
+    /**
+     * @brief Slots and queues of a loader thread
+     */
+    struct loader {
+        vector<prepared_batch> slots; //*< Batches being loaded or used */
+        spsc_queue<int> ready, free; //*< Loaded slots (to the network) and used slots (back to the loader) */
+        atomic<unsigned> finished; //*< Last pass the thread is done with */
+        thread worker; //*< Loader thread */
+
+        explicit loader(int depth) : slots(depth), ready(depth), free(depth), finished(0) {}
+    };
+
+    const data_set* dataset; //*< Dataset of the current pass */
+    int num_outputs, batch_size, slices, chunk; //*< Classes, samples of a batch, slices of a batch and samples of a slice */
+    double sparse_threshold; //*< Highest input density of a slice taken from the sparse copy */
+    const int* order; //*< Order of the samples (null: file order) */
+    const augmenter* augment; //*< Random transforms of the inputs (null: none) */
+    unsigned long long round; //*< Round of the random transforms (see augmenter::key) */
+    int batches; //*< Batches of the dataset */
+
+    vector<unique_ptr<loader>> loaders; //*< Loader threads */
+    int current; //*< Batch being used by the network */
+    int current_slot; //*< Slot of the batch being used */
+    atomic<unsigned> pass; //*< Current pass, the threads wait for it to change */
+    atomic<bool> cancel; //*< Set while a restart waits for the threads to leave an unfinished pass */
+    atomic<bool> stop; //*< Set when the loader is destroyed */
+
+public:
+    /**
+     * @brief Constructor, starts the loader threads (nothing is loaded until restart)
+     * @param num_outputs Number of classes
+     * @param batch_size Samples of each batch
+     * @param slices Slices of each batch
+     * @param chunk Samples of each slice (0: the batch is split evenly in slices)
+     * @param sparse_threshold Highest input density of a slice taken from the sparse copy
+     * @param depth Batches loaded ahead by each thread
+     * @param threads Loader threads
+     * @param augment Random transforms of the inputs, applied on the loader threads (must stay
+     * valid while loading), null for none
+     */
+    batch_loader(int num_outputs, int batch_size, int slices, int chunk, double sparse_threshold,
+                 int depth = 2, int threads = 1, const augmenter* augment = nullptr);
+
+    batch_loader(const batch_loader&) = delete;
+    batch_loader& operator=(const batch_loader&) = delete;
+
+    /**
+     * @brief Destructor, stops the loader threads
+     */
+    ~batch_loader();
+
+    /**
+     * @brief Start loading the batches of a dataset from the first one
+     * @details Batches of the previous pass not taken yet are dropped. Must not be called
+     * between next and release
+     * @param dataset Dataset (must stay open while loading)
+     * @param order Index of the sample at each position (e.g. from an epoch_sampler, must stay
+     * valid while loading), null for file order
+     * @param round Round of the random transforms (see augmenter::key)
+     */
+    void restart(const data_set& dataset, const int* order = nullptr, unsigned long long round = 0);
+
+    /**
+     * @brief Wait for the next batch
+     * @return Batch, valid until release
+     */
+    const prepared_batch& next();
+
+    /**
+     * @brief Give the batch returned by next back to its loader
+     */
+    void release();
+
+    /**
+     * @brief Samples of a slice of a batch
+     * @param start First sample of the batch
+     * @param size Samples of the batch
+     * @param index Index of the slice
+     * @param slices Slices of the batch
+     * @param chunk Samples of each slice (0: the batch is split evenly in slices)
+     * @param first Result, first sample of the slice
+     * @param last Result, sample after the last one of the slice
+     */
+    static void slice(int start, int size, int index, int slices, int chunk, int& first, int& last);
+
+private:
+    /**
+     * @brief Loop of a loader thread
+     * @param index Index of the thread
+     */
+    void load(int index);
+
+    /**
+     * @brief Load a batch into a slot
+     * @param batch Index of the batch
+     * @param result Slot
+     */
+    void prepare(int batch, prepared_batch& result) const;
+};
+
+#endif
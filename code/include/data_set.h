@@ -6,26 +6,82 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <memory>
+#include <stdexcept>
 
 #include "functions.h"
+#include "matrix.h"
+#include "sparse.h"
 
 using namespace std;
 
+/**
+ * @brief Where the samples of a dataset live
+ */
+enum class dataset_storage {
+    owning, //*< Every sample copied into its own vector (data and labels) */
+    mapped, //*< Samples read straight from the files mapped in memory (shared page cache, no copies) */
+    borrowed, //*< Samples kept in memory by someone else (e.g. a window of a streaming_data_set) */
+    cached, //*< Samples read straight from a mapped dataset_cache, built first if missing or stale */
+    compressed //*< Samples zero-suppressed in memory (mask of the non zero pixels and their values) */
+};
+
+/**
+ * @brief Sparse samples gathered out of order (see data_set::sparse_batch)
+ * @details Reused from batch to batch, so it stops allocating once it has held the biggest batch
+ */
+struct sparse_buffer {
+    vector<int> offsets, indices; //*< Start of each sample and positions of its non zero pixels */
+    vector<unsigned char> values; //*< Values of the non zero pixels */
+};
+
 /**
  * @brief Struct that holds the data and labels of a dataset
+ * @details Samples and labels are read through size, sample and label, which work with any
+ * storage but compressed (use copy_sample or load_batch, which decode the samples).
+ * data is only filled with dataset_storage::owning, labels with owning and compressed
  */
 struct data_set { //Why a struct? I dont know, i was stupid back then
 public:
-    vector<vector<unsigned char>> data; //*< Data of the dataset */
-    vector<unsigned char> labels; //*< Labels of the dataset */
+    vector<vector<unsigned char>> data; //*< Data of the dataset (owning storage) */
+    vector<unsigned char> labels; //*< Labels of the dataset (owning and compressed storage) */
     string path; //*< Path of the dataset */
 
+    dataset_storage storage; //*< Where the samples live */
+    int num_samples, num_pixels; //*< Number of samples and pixels of each sample */
+    int sample_stride; //*< Bytes between consecutive samples (mapped, borrowed and cached storage) */
+    real pixel_scale; //*< Value of a pixel byte of 1 (1 but in cached storage, which reads it from the cache) */
+    shared_ptr<const unsigned char> mapped_images; //*< Mapped image or cache file (shared by copies) */
+    shared_ptr<const unsigned char> mapped_labels; //*< Mapped label or cache file (shared by copies) */
+    const unsigned char* images; //*< First pixel of the first sample (mapped, borrowed and cached storage) */
+    const unsigned char* image_labels; //*< First label (mapped, borrowed and cached storage) */
+
+    int mask_stride; //*< Bytes of the mask of each sample, whole 64 bit words (compressed storage) */
+    vector<unsigned char> packed_masks; //*< Bit i of a mask is set if pixel i is not zero */
+    vector<unsigned char> packed_values; //*< Non zero pixels of every sample, padded for the decoder */
+    vector<size_t> packed_offsets; //*< Start of each sample in packed_values */
+
+    vector<int> sparse_offsets; //*< Start of each sample in the sparse arrays (empty if not built) */
+    vector<int> sparse_indices; //*< Positions of the non zero pixels of every sample */
+    vector<unsigned char> sparse_values; //*< Values of the non zero pixels of every sample */
+
     /**
      * @brief Constructor
      * @param data_path Path to the data file
      * @param label_path Path to the label file
+     * @param storage Where the samples live (default: copied)
+     */
+    explicit data_set(const string& data_path, const string& label_path,
+                      dataset_storage storage = dataset_storage::owning); //*< Constructor */
+
+    /**
+     * @brief Constructor of a view of samples kept in memory by the caller (borrowed storage)
+     * @param images Pixels of every sample, one after the other
+     * @param labels Label of every sample
+     * @param samples Number of samples
+     * @param pixels Number of pixels of each sample
      */
-    explicit data_set(const string& data_path, const string& label_path); //*< Constructor */
+    data_set(const unsigned char* images, const unsigned char* labels, int samples, int pixels);
 
     /**
      * @brief Destructor
@@ -38,13 +94,161 @@ public:
      * @brief Open the dataset
      * @param data_path Path to the data file
      * @param label_path Path to the label file
+     * @param storage Where the samples live (default: copied)
+     * @details Mapped and cached storage need a POSIX system, elsewhere the samples are copied.
+     * The cache of cached storage is dataset_cache::default_path(data_path)
+     */
+    void open(const string& data_path, const string& label_path, dataset_storage storage = dataset_storage::owning);
+
+    /**
+     * @brief Open the files of a dataset and check their headers
+     * @param data_path Path to the data file
+     * @param label_path Path to the label file
+     * @param fi_data Data file, left at the first pixel of the first sample
+     * @param fi_labels Label file, left at the first label
+     * @param num_images Number of samples
+     * @param num_rows Rows of each sample
+     * @param num_cols Columns of each sample
+     */
+    static void read_headers(const string& data_path, const string& label_path, ifstream& fi_data,
+                             ifstream& fi_labels, int& num_images, int& num_rows, int& num_cols);
+
+    /**
+     * @brief Get the number of samples
+     */
+    [[nodiscard]] inline int size() const {return num_samples;};
+
+    /**
+     * @brief Get the number of pixels of each sample
+     */
+    [[nodiscard]] inline int sample_size() const {return num_pixels;};
+
+    /**
+     * @brief Get the value of a pixel byte of 1, for n_network::set_input_scale
+     * @details A dataset_cache stores its own scale (1/255, pixels in [0, 1]); the IDX storages
+     * keep the bytes as they are (1)
+     */
+    [[nodiscard]] inline real scale() const {return pixel_scale;};
+
+    /**
+     * @brief Get the pixels of a sample
+     * @param index Index of the sample
+     * @return View of the pixels (valid while the dataset is open)
+     */
+    [[nodiscard]] inline array_view<const unsigned char> sample(int index) const {
+        if(storage != dataset_storage::owning){
+            if(storage == dataset_storage::compressed)
+                throw runtime_error("Compressed samples have to be decoded (copy_sample)");
+            return array_view<const unsigned char>(images + (size_t)index * sample_stride, num_pixels);
+        }
+        return data[index];
+    };
+
+    /**
+     * @brief Copy the pixels of a sample, decoding them if compressed
+     * @param index Index of the sample
+     * @param destination Destination of the pixels (sample_size bytes)
      */
-    void open(const string& data_path, const string& label_path);
+    void copy_sample(int index, unsigned char* destination) const;
+
+    /**
+     * @brief Get the bytes of the samples and labels held by the dataset itself
+     * @details Mapped, cached and borrowed samples live in the page cache or in someone else's
+     * memory and do not count
+     */
+    [[nodiscard]] size_t memory_size() const;
+
+    /**
+     * @brief Get the label of a sample
+     * @param index Index of the sample
+     */
+    [[nodiscard]] inline unsigned char label(int index) const {
+        if(storage == dataset_storage::owning || storage == dataset_storage::compressed) return labels[index];
+        return image_labels[index];
+    };
+
+    /**
+     * @brief Copy consecutive samples into a matrix (one sample per row)
+     * @param start_pos Index of the first sample
+     * @param batch_size Number of samples
+     * @param batch Destination matrix, resized if needed
+     * @param scale Factor applied to every pixel
+     */
+    void load_batch(int start_pos, int batch_size, matrix& batch, real scale = 1) const;
+
+    /**
+     * @brief Copy consecutive samples into a byte matrix (one sample per row)
+     * @param start_pos Index of the first sample
+     * @param batch_size Number of samples
+     * @param batch Destination matrix, resized if needed
+     * @details 1 byte per pixel: the layers widen the pixels in registers
+     */
+    void load_batch(int start_pos, int batch_size, byte_matrix& batch) const;
+
+    /**
+     * @brief Copy samples in any order into a byte matrix (one sample per row)
+     * @param indices Index of the sample of each row (e.g. from an epoch_sampler)
+     * @param batch_size Number of samples
+     * @param batch Destination matrix, resized if needed
+     */
+    void load_batch(const int* indices, int batch_size, byte_matrix& batch) const;
+
+    /**
+     * @brief One-hot labels of consecutive samples (one sample per row)
+     * @param start_pos Index of the first sample
+     * @param batch_size Number of samples
+     * @param classes Number of classes (columns)
+     * @param expected Destination matrix, resized if needed
+     */
+    void load_one_hot(int start_pos, int batch_size, int classes, matrix& expected) const;
+
+    /**
+     * @brief One-hot labels of samples in any order (one sample per row)
+     * @param indices Index of the sample of each row
+     * @param batch_size Number of samples
+     * @param classes Number of classes (columns)
+     * @param expected Destination matrix, resized if needed
+     */
+    void load_one_hot(const int* indices, int batch_size, int classes, matrix& expected) const;
 
     /**
      * @brief Close the dataset
      */
-    void close(){data = {}; labels = {};};
+    void close(){
+        data = {}; labels = {}; sparse_offsets = {}; sparse_indices = {}; sparse_values = {};
+        packed_masks = {}; packed_values = {}; packed_offsets = {};
+        mapped_images.reset(); mapped_labels.reset(); images = image_labels = nullptr;
+        num_samples = num_pixels = sample_stride = mask_stride = 0;
+        pixel_scale = 1;
+    };
+
+    /**
+     * @brief Build the sparse (non zero pixels only) copy of the samples
+     * @details Used by the network to skip the zero inputs of the first layer
+     */
+    void build_sparse();
+
+    /**
+     * @brief Check if the sparse copy of the samples is built
+     */
+    [[nodiscard]] bool has_sparse() const {return !sparse_offsets.empty();};
+
+    /**
+     * @brief Get consecutive samples from the sparse copy
+     * @param start_pos Index of the first sample
+     * @param batch_size Number of samples
+     * @return View of the samples (valid while the dataset is open)
+     */
+    [[nodiscard]] sparse_matrix sparse_batch(int start_pos, int batch_size) const;
+
+    /**
+     * @brief Gather samples in any order from the sparse copy
+     * @param indices Index of the sample of each row
+     * @param batch_size Number of samples
+     * @param buffer Destination of the samples
+     * @return View of the samples (valid until the buffer changes)
+     */
+    [[nodiscard]] sparse_matrix sparse_batch(const int* indices, int batch_size, sparse_buffer& buffer) const;
 };
 
 
@@ -0,0 +1,89 @@
+#ifndef DATASET_CACHE_H
+#define DATASET_CACHE_H
+
+#include <cstdint>
+#include <string>
+
+#include "aligned.h"
+
+using namespace std;
+
+/**
+ * @brief Header at the start of a dataset cache file
+ * @details The file is the header, one checksum per shard, the labels and then the samples,
+ * each part starting on a cache line. Samples are uint8 pixels padded to a whole number of
+ * cache lines (stride), so every sample is aligned like a byte_matrix row. A pixel is worth
+ * its byte times scale. Shards are consecutive groups of samples with their own checksum.
+ * The struct is padded to whole cache lines; the padding after checksum is written as zeros
+ * but is not covered by any checksum
+ */
+struct alignas(CACHE_LINE) dataset_cache_header {
+    char magic[8]; //*< "NNCACHE" */
+    uint32_t version; //*< Version of the format */
+    uint32_t samples, rows, cols; //*< Number of samples and size of each one */
+    uint32_t stride; //*< Bytes between samples */
+    uint32_t shard_samples, shards; //*< Samples of each shard and number of shards */
+    float scale; //*< Value of a pixel of 1 (e.g. 1/255 for values in [0, 1]) */
+    uint64_t image_size, label_size; //*< Sizes of the source IDX files */
+    int64_t image_time, label_time; //*< Modification times of the source IDX files */
+    uint64_t labels_offset, images_offset; //*< Positions of the labels and of the first sample */
+    uint64_t labels_checksum; //*< Checksum of the labels */
+    uint64_t checksum; //*< Checksum of the fields before this one and of the shard checksums (last field) */
+};
+
+/**
+ * @brief Preprocessed copy of an IDX dataset that opens by mmap without parsing anything
+ * @details Built once from the IDX files (build or the build_cache tool). The cache remembers
+ * the size and modification time of its sources, so is_valid fails as soon as they change
+ */
+class dataset_cache {
+public:
+    static const uint32_t VERSION = 2; //*< Version of the format written by build */
+
+    /**
+     * @brief Default cache file of an IDX image file
+     */
+    static string default_path(const string& data_path) {return data_path + ".nncache";};
+
+    /**
+     * @brief Convert IDX files into a cache file
+     * @param data_path Path to the data file
+     * @param label_path Path to the label file
+     * @param cache_path Path to the cache file (replaced atomically)
+     * @param shard_samples Samples of each shard
+     */
+    static void build(const string& data_path, const string& label_path, const string& cache_path,
+                      int shard_samples = 8192);
+
+    /**
+     * @brief Check the header of a cache and that its sources have not changed
+     * @param cache_path Path to the cache file
+     * @param data_path Path to the data file
+     * @param label_path Path to the label file
+     * @details Only reads the header and the shard checksums (see verify for the samples)
+     */
+    static bool is_valid(const string& cache_path, const string& data_path, const string& label_path);
+
+    /**
+     * @brief Check the checksums of the labels and of every shard of a cache
+     * @param cache_path Path to the cache file
+     * @return False if the file is damaged
+     */
+    static bool verify(const string& cache_path);
+
+    /**
+     * @brief Check the header checksum of a cache (header followed by its shard checksums)
+     * @details The shard checksums have to be readable right after the header
+     */
+    static bool header_valid(const dataset_cache_header& header);
+
+    /**
+     * @brief 64 bit FNV-1a checksum
+     * @param data Bytes
+     * @param size Number of bytes
+     * @param checksum Checksum of the previous bytes
+     */
+    static uint64_t checksum(const void* data, size_t size, uint64_t checksum = 14695981039346656037ull);
+};
+
+#endif
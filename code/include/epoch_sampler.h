@@ -0,0 +1,56 @@
+#ifndef EPOCH_SAMPLER_H
+#define EPOCH_SAMPLER_H
+
+#include <random>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief Order in which an epoch visits the samples of a dataset, shuffled by blocks
+ * @details The samples are split in blocks of consecutive samples and the blocks are shuffled,
+ * then the samples are shuffled within windows of a few blocks (about what the batch loader
+ * gathers ahead). A window only touches a few contiguous runs of memory, so the gathers stay
+ * friendly to the caches and the TLB with copied, mapped or cached storage alike.
+ * The order only depends on the seed, the epoch and the window, and once the buffers have
+ * grown to the biggest dataset no epoch allocates
+ */
+class epoch_sampler {
+private:
+    int block_samples, window_blocks; //*< Samples of each block and blocks of each shuffle window */
+    unsigned seed; //*< Seed of every epoch */
+    vector<int> blocks; //*< Order of the blocks */
+    vector<int> order; //*< Order of the samples */
+    mt19937 random; //*< Random numbers of the shuffle */
+
+public:
+    /**
+     * @brief Constructor
+     * @param block_samples Samples of each block (1: plain shuffle)
+     * @param window_blocks Blocks of each window the samples are shuffled within
+     * @param seed Seed of the shuffle
+     */
+    explicit epoch_sampler(int block_samples = 64, int window_blocks = 8, unsigned seed = 1);
+
+    /**
+     * @brief Make room for datasets of up to this many samples (shuffle then never allocates)
+     */
+    void reserve(int samples);
+
+    /**
+     * @brief Shuffle the samples of a dataset for an epoch
+     * @param samples Number of samples
+     * @param epoch Index of the epoch
+     * @param window Index of the window of the epoch (streamed datasets)
+     * @return Index of the sample at each position (samples elements, valid until the next shuffle)
+     */
+    const int* shuffle(int samples, unsigned epoch, unsigned window = 0);
+
+private:
+    /**
+     * @brief Random number in [0, n) (same on every platform, unlike uniform_int_distribution)
+     */
+    unsigned below(unsigned n) {return (unsigned)(((unsigned long long)random() * n) >> 32);};
+};
+
+#endif
@@ -1,35 +1,37 @@
 #ifndef FUNCTIONS_H
 #define FUNCTIONS_H
 
+#include "precision.h"
+
 // This shoyld be in its own namespace, but i was stupid back then
 
 /**
  * @brief ReLu activation function
  * @param input the input value
  */
-double ReLu(double input);
+real ReLu(real input);
 
 /**
  * @brief Derivative of ReLu activation function
  * @param input the input value
  */
-double d_ReLu(double input);
+real d_ReLu(real input);
 
 //Constants outside a namespace? Jeez...
-const double MAX_SIG = 0.99; //*< Max value of the sigmoid function */
-const double MIN_SIG = 0.01; //*< Min value of the sigmoid function */
+const real MAX_SIG = 0.99; //*< Max value of the sigmoid function */
+const real MIN_SIG = 0.01; //*< Min value of the sigmoid function */
 
 /**
  * @brief Sigmoid activation function
  * @param input the input value
  */
-double sig(double input);
+real sig(real input);
 
 /**
  * @brief Derivative of Sigmoid activation function
  * @param input the input value
  */
-double d_sig(double input);
+real d_sig(real input);
 
 
 /**
@@ -37,15 +39,15 @@ double d_sig(double input);
  */
 struct activation{
     
-    double (*function)(double); //*< Activation function */
-    double (*derivative)(double); //*< Derivative of the activation function */
+    real (*function)(real); //*< Activation function */
+    real (*derivative)(real); //*< Derivative of the activation function */
 
     /**
      * @brief Constructor
      * @param function Activation function
      * @param derivative Derivative of the activation function
      */
-    explicit activation(double (*function)(double) = ReLu, double (*derivative)(double)  = d_ReLu) {
+    explicit activation(real (*function)(real) = ReLu, real (*derivative)(real)  = d_ReLu) {
         this->function = function;
         this->derivative = derivative;
     }
@@ -0,0 +1,84 @@
+#ifndef GRADIENT_COMPRESSION_H
+#define GRADIENT_COMPRESSION_H
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "aligned.h"
+#include "precision.h"
+
+using namespace std;
+
+/**
+ * @brief Encodings of the gradients sent between training processes
+ */
+enum class compression {
+    none, //*< Every accumulator as it is */
+    fp16, //*< IEEE half precision (2 bytes, saturated to the largest finite half) */
+    bf16, //*< Upper half of a float (2 bytes, float range with 8 bit mantissa) */
+    top_k, //*< Only the largest gradients (index and float), the rest is kept for later (error feedback) */
+    int8 //*< 1 byte per gradient, scaled per block and rounded stochastically (unbiased) */
+};
+
+/**
+ * @brief Get the name of an encoding
+ */
+const char* compression_name(compression method);
+
+/**
+ * @brief Get an encoding from its name
+ * @param name Name (see compression_name)
+ * @param method Result, unchanged if the name is unknown
+ * @return False if the name is unknown
+ */
+bool parse_compression(const string& name, compression& method);
+
+/**
+ * @brief Encodes gradients into messages and decodes them back
+ * @details Each sender needs its own compressor, since top_k keeps the gradients it has not
+ * sent yet (added to the next ones) and int8 has its own random numbers. Reusing a compressor
+ * for gradients of the same size performs no heap allocation
+ */
+class gradient_compressor {
+private:
+    compression method; //*< Encoding */
+    double top_k_ratio; //*< Fraction of the gradients sent by top_k */
+    aligned_vector<accumulator> residual; //*< Gradients not sent yet (top_k) */
+    vector<uint32_t> order; //*< Indices sorted by magnitude (top_k) */
+    mt19937 random; //*< Random numbers of the stochastic rounding (int8) */
+
+public:
+    /**
+     * @brief Constructor
+     * @param method Encoding
+     * @param top_k_ratio Fraction of the gradients sent by top_k
+     * @param seed Seed of the stochastic rounding
+     */
+    explicit gradient_compressor(compression method = compression::none, double top_k_ratio = 0.01,
+                                 unsigned seed = 1);
+
+    [[nodiscard]] compression get_method() const {return method;};
+
+    /**
+     * @brief Set the seed of the stochastic rounding (give each sender its own)
+     */
+    void seed(unsigned value) {random.seed(value);};
+
+    /**
+     * @brief Encode gradients
+     * @param gradients Gradients
+     * @param message Result, resized to the bytes of the encoding
+     */
+    void compress(array_view<const accumulator> gradients, vector<unsigned char>& message);
+
+    /**
+     * @brief Decode gradients
+     * @param message Encoded gradients
+     * @param gradients Result, with the size of the encoded gradients
+     */
+    void decompress(const vector<unsigned char>& message, array_view<accumulator> gradients) const;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <string>
+
+#include "precision.h"
+
+using namespace std;
+
+/**
+ * @brief Instruction sets with their own version of the kernels
+ */
+enum class isa {
+    scalar, //*< Plain C++ loops */
+    sse2,   //*< 128 bit vectors (every x86-64 CPU) */
+    avx2,   //*< 256 bit vectors with FMA */
+    avx512  //*< 512 bit vectors with FMA */
+};
+
+/**
+ * @brief Table with one version of every numeric kernel used by the layers
+ * @details All the versions compute the same thing, only the rounding of sums may differ.
+ * Sums are carried in the accumulator type. Within one table, dot_block gives exactly
+ * the same result as calling dot on each element
+ */
+struct kernel_table {
+    isa type; //*< Instruction set of the kernels */
+
+    /**
+     * @brief Dot product of two arrays added to an initial value
+     * @details init + a[0]*b[0] + ... + a[n-1]*b[n-1]
+     */
+    accumulator (*dot)(const real* a, const real* b, int n, accumulator init);
+
+    /**
+     * @brief Dot products of a block of rows: c[r][j] = dot(a row r, b row j, n, c[r][j])
+     * @details Register tiled so every loaded row is reused for several outputs
+     */
+    void (*dot_block)(const real* a, int stride_a, const real* b, int stride_b,
+                      real* c, int stride_c, int rows, int cols, int n);
+
+    /**
+     * @brief Scaled addition: y[i] += factor * x[i]
+     */
+    void (*axpy)(real factor, const real* x, real* y, int n);
+
+    /**
+     * @brief Scaled addition into a gradient: g[i] += factor * x[i]
+     */
+    void (*accumulate)(accumulator factor, const real* x, accumulator* g, int n);
+
+    /**
+     * @brief Gradient descent step: w[i] -= learning_rate * (g[i] / batch_size), then g[i] = 0
+     */
+    void (*update)(real* w, accumulator* g, int n, real learning_rate, real batch_size);
+
+    /**
+     * @brief dot with byte inputs, each one widened and multiplied by scale in registers
+     * @details Same result as dot on an array holding (accumulator)a[i] * scale
+     */
+    accumulator (*dot_bytes)(const unsigned char* a, real scale, const real* b, int n, accumulator init);
+
+    /**
+     * @brief dot_block with byte inputs (see dot_bytes)
+     */
+    void (*dot_block_bytes)(const unsigned char* a, int stride_a, real scale, const real* b, int stride_b,
+                            real* c, int stride_c, int rows, int cols, int n);
+
+    /**
+     * @brief accumulate with byte inputs: g[i] += factor * (x[i] * scale)
+     */
+    void (*accumulate_bytes)(accumulator factor, const unsigned char* x, real scale, accumulator* g, int n);
+
+    /**
+     * @brief Move gradients into others: y[i] += x[i], then x[i] = 0
+     * @details Exact same sums in every version (used to reduce the gradients of several threads)
+     */
+    void (*merge)(accumulator* x, accumulator* y, int n);
+
+    /**
+     * @brief Zero-suppressed decode: out[i] is the next value if bit i of mask is set, else 0
+     * @details Bit i of the mask is bit i % 8 of byte i / 8. Whole 64 bit words of the mask and
+     * up to 64 bytes after the last value used can be read, so both arrays must be padded
+     * @return Number of values used
+     */
+    int (*expand_bytes)(const unsigned char* mask, const unsigned char* values, unsigned char* out, int n);
+};
+
+/**
+ * @brief Get the kernels of the selected instruction set
+ * @details On first use the best instruction set supported by the CPU is selected (CPUID),
+ * unless the environment variable NN_ISA (scalar, sse2, avx2 or avx512) forces one
+ */
+const kernel_table& kernels();
+
+/**
+ * @brief Force an instruction set (e.g. for benchmarks)
+ * @param type Instruction set
+ * @return False if the CPU or the build does not support it (nothing changes)
+ */
+bool set_isa(isa type);
+
+/**
+ * @brief Check if an instruction set can be used on this CPU and build
+ * @param type Instruction set
+ */
+bool isa_supported(isa type);
+
+/**
+ * @brief Best instruction set supported by this CPU and build
+ */
+isa best_isa();
+
+/**
+ * @brief Name of an instruction set
+ */
+const char* isa_name(isa type);
+
+/**
+ * @brief Instruction set from its name
+ * @param name Name (scalar, sse2, avx2 or avx512)
+ * @param type Result
+ * @return False if the name is not known
+ */
+bool parse_isa(const string& name, isa& type);
+
+//Versions of the kernels (each in its own file, compiled for its instruction set)
+extern const kernel_table scalar_kernels; //*< Plain C++ kernels */
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define NN_X86_KERNELS
+extern const kernel_table sse2_kernels;   //*< SSE2 kernels */
+extern const kernel_table avx2_kernels;   //*< AVX2 + FMA kernels */
+extern const kernel_table avx512_kernels; //*< AVX-512F kernels */
+extern const kernel_table avx512_vbmi2_kernels; //*< AVX-512F kernels with the VBMI2 byte expand */
+#endif
+
+#endif
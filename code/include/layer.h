@@ -7,27 +7,47 @@
 #include  <iostream>
 
 #include "functions.h"
+#include "matrix.h"
+#include "thread_pool.h"
 
 
 using namespace std;
 
+/**
+ * @brief Buffers written by the batch forward and backward passes of a layer
+ * @details Each layer owns one set. Threads that train the same layers at once pass
+ * their own set to the const overloads, so the weights are only read
+ */
+struct layer_buffers {
+    matrix outputs; //*< Outputs of the layer for a batch (one row per sample) */
+    matrix deltas; //*< Deltas of the layer for a batch (one row per sample) */
+
+    gradient_matrix weight_gradients; //*< Gradients of the weights */
+    aligned_vector<accumulator> bias_gradients; //*< Gradients of the bias */
+};
+
 /**
  * @brief Class that represents a layer of a neural network
+ * @details Weights and weight gradients are nodes x inputs row-major matrices in
+ * a single aligned buffer each, so the forward and backward loops walk memory linearly
  */
 class layer {
 private:
-    vector<vector<double>> weights; //*< Weights of the layer */
-    vector<double> bias; //*< Bias of the layer */
+    matrix weights; //*< Weights of the layer (one row per node) */
+    aligned_vector<real> bias; //*< Bias of the layer */
 
-    vector<double> outputs; //*< Outputs of the layer */
-    vector<double> deltas; //*< Deltas of the layer */
+    aligned_vector<real> outputs; //*< Outputs of the layer */
+    aligned_vector<real> deltas; //*< Deltas of the layer */
 
-    vector<vector<double>> weight_gradients; //*< Gradients of the weights */
-    vector<double> bias_gradients; //*< Gradients of the bias */
+    layer_buffers buffers; //*< Batch outputs, deltas and gradients of the layer */
  
     activation activation_function; //*< Activation function of the layer */
+    real input_scale; //*< Factor applied to inputs given as bytes (e.g. 1/255) */
     int nodes, inputs; //*< Number of nodes and inputs of the layer */
 
+    thread_pool* pool; //*< Threads that share the nodes of big layers (not owned, may be null) */
+    long parallel_threshold; //*< Fewest weights for which the nodes are shared by the pool */
+
 
 public:
     
@@ -55,7 +75,7 @@ public:
      * @param node Node
      * @return Bias of the node
      */
-    [[nodiscard]] inline double get_bias(int node) const {return bias[node];};
+    [[nodiscard]] inline real get_bias(int node) const {return bias[node];};
 
     /**
      * @brief Get the weight of a node
@@ -63,21 +83,34 @@ public:
      * @param input Input
      * @return Weight of the node
      */
-    [[nodiscard]] inline double get_weight(int node, int input) const {return this->weights[node][input];};
+    [[nodiscard]] inline real get_weight(int node, int input) const {return this->weights(node, input);};
+
+    /**
+     * @brief Get the weights of a node
+     * @param node Node
+     * @return Contiguous view of the weights of the node
+     */
+    [[nodiscard]] inline array_view<const real> get_weights(int node) const {return weights.row(node);};
+
+    /**
+     * @brief Get the weight matrix of the layer
+     * @return Weights (nodes x inputs, row-major)
+     */
+    [[nodiscard]] inline const matrix& get_weight_matrix() const {return weights;};
 
     /**
      * @brief Get the output of a node
      * @param node Node
      * @return Output of the node
      */
-    [[nodiscard]] inline double get_output(int node) const {return outputs[node];};
+    [[nodiscard]] inline real get_output(int node) const {return outputs[node];};
 
     /**
      * @brief Get the delta of a node
      * @param node Node
      * @return Delta of the node (used for backpropagation)
      */
-    [[nodiscard]] inline double get_delta(int node) const {return deltas[node];};
+    [[nodiscard]] inline real get_delta(int node) const {return deltas[node];};
 
     /**
      * @brief Get the number of nodes of the layer
@@ -100,19 +133,58 @@ public:
     /**
      * @brief Get the outputs of the layer
      */
-    [[nodiscard]] inline const vector<double>& get_outputs() const {return outputs;};
+    [[nodiscard]] inline array_view<const real> get_outputs() const {return outputs;};
 
     /**
      * @brief Get the deltas of the layer
      */
-    [[nodiscard]] inline const vector<double>& get_deltas() const {return deltas;};
+    [[nodiscard]] inline array_view<const real> get_deltas() const {return deltas;};
+
+    /**
+     * @brief Get the bias of the layer
+     */
+    [[nodiscard]] inline array_view<const real> get_biases() const {return bias;};
+
+    /**
+     * @brief Get the outputs of the last batch forward pass
+     * @return Outputs (samples x nodes)
+     */
+    [[nodiscard]] inline const matrix& get_batch_outputs() const {return buffers.outputs;};
 
     
+    /**
+     * @brief Get the factor applied to inputs given as bytes
+     */
+    [[nodiscard]] inline real get_input_scale() const {return input_scale;};
+
     /**
      * @brief Set the activation function of the layer
      */
     void set_activation_function(const activation& new_activation);
 
+    /**
+     * @brief Set the factor applied to inputs given as bytes (default 1)
+     * @details Bytes are widened and scaled in registers, never copied to a real buffer
+     */
+    inline void set_input_scale(real scale) {input_scale = scale;};
+
+    /**
+     * @brief Share the nodes of the layer across a thread pool when it is big enough
+     * @param shared_pool Pool (not owned, null to always run on the caller)
+     * @param threshold Fewest weights (nodes x inputs) for which the pool is used
+     * @details The single sample forward pass, the single sample gradient and the weight update
+     * give each thread a range of nodes, so one request runs on several cores. The results do
+     * not change. Below the threshold the cost of waking the threads is larger than the gain
+     */
+    void set_thread_pool(thread_pool* shared_pool, long threshold = PARALLEL_THRESHOLD);
+
+    /**
+     * @brief Default fewest weights for which a layer uses its thread pool
+     * @details tools/bench_latency finds the crossover of a machine (p50 of calculate_outputs
+     * with and without a pool for growing layers)
+     */
+    static const long PARALLEL_THRESHOLD = 1 << 16;
+
     /**
      * @brief Set the number of nodes of the layer
      */
@@ -159,37 +231,93 @@ public:
      * @param input_vector Input vector
      * @return Outputs of the layer
      */
-    const vector<double>& calculate_outputs(const vector<unsigned char>& input_vector);
+    array_view<const real> calculate_outputs(array_view<const unsigned char> input_vector);
 
     /**
      * @brief Calculate the outputs of the layer (Forward pass)
      * @param input_vector Input vector
      * @return Outputs of the layer
      */
-    const vector<double>& calculate_outputs(const vector<double>& input_vector);
+    array_view<const real> calculate_outputs(array_view<const real> input_vector);
+
+    /**
+     * @brief Calculate the outputs of the layer into a buffer (Forward pass)
+     * @param input_vector Input vector
+     * @param output Output buffer (one element per node)
+     * @details The layer is not modified and nothing is allocated, so a const layer
+     * can be shared by several callers with their own buffers
+     */
+    void calculate_outputs(array_view<const real> input_vector, array_view<real> output) const;
+
+    /**
+     * @brief Calculate the outputs of the layer into a buffer from byte inputs (Forward pass)
+     * @param input_vector Input vector (multiplied by the input scale)
+     * @param output Output buffer (one element per node)
+     */
+    void calculate_outputs(array_view<const unsigned char> input_vector, array_view<real> output) const;
+
+    /**
+     * @brief Calculate the outputs of the layer into a buffer from sparse byte inputs (Forward pass)
+     * @param input_vector Non zero inputs (multiplied by the input scale)
+     * @param output Output buffer (one element per node)
+     * @details Only the weights of the non zero inputs are read
+     */
+    void calculate_outputs(const sparse_vector& input_vector, array_view<real> output) const;
+
+    /**
+     * @brief Calculate the outputs of the layer for a batch (Forward pass)
+     * @param inputs Input matrix (one sample per row)
+     * @return Outputs of the layer (one sample per row)
+     * @details One tiled matrix product with the bias and activation fused in
+     */
+    const matrix& calculate_outputs(const matrix& inputs);
+
+    /**
+     * @brief Calculate the outputs of the layer for a batch of byte inputs (Forward pass)
+     * @param inputs Input matrix (one sample per row, multiplied by the input scale)
+     * @return Outputs of the layer (one sample per row)
+     */
+    const matrix& calculate_outputs(const byte_matrix& inputs);
+
+    /**
+     * @brief Calculate the outputs of the layer for a batch of sparse byte inputs (Forward pass)
+     * @param inputs Non zero inputs of each sample (multiplied by the input scale)
+     * @return Outputs of the layer (one sample per row)
+     */
+    const matrix& calculate_outputs(const sparse_matrix& inputs);
+
+    /**
+     * @brief Calculate the outputs of the layer for a batch into the buffers of the caller (Forward pass)
+     * @param inputs Input matrix (one sample per row)
+     * @param buffers Buffers of the caller (the outputs are written)
+     * @return Outputs of the layer (one sample per row)
+     */
+    const matrix& calculate_outputs(const matrix& inputs, layer_buffers& buffers) const;
+    const matrix& calculate_outputs(const byte_matrix& inputs, layer_buffers& buffers) const;
+    const matrix& calculate_outputs(const sparse_matrix& inputs, layer_buffers& buffers) const;
 
     /**
      * @brief Calculate the gradient of the output layer (Backpropagation)
      * @param input Input vector
      * @param expected_outputs Expected outputs
      */
-    void calculate_output_gradient(const vector<double>& input,
-                                   const vector<double>& expected_outputs);    
+    void calculate_output_gradient(array_view<const real> input,
+                                   const vector<real>& expected_outputs);    
 
     /**
      * @brief Calculate the gradient of the output layer (Backpropagation)
      * @param input Input vector
      * @param expected_outputs Expected outputs
      */                              
-    void calculate_output_gradient(const vector<unsigned char>& input,
-                                   const vector<double>& expected_outputs);
+    void calculate_output_gradient(array_view<const unsigned char> input,
+                                   const vector<real>& expected_outputs);
 
     /**
      * @brief Calculate the gradient of a hidden layer (Backpropagation)
      * @param input Input vector
      * @param previous_layer Previous layer
      */
-    void calculate_hidden_gradient(const vector<double>& input,
+    void calculate_hidden_gradient(array_view<const real> input,
                                    const layer& previous_layer);
 
     /**
@@ -197,21 +325,158 @@ public:
      * @param input Input vector
      * @param previous_layer Previous layer
      */
-    void calculate_hidden_gradient(const vector<unsigned char>& input,
+    void calculate_hidden_gradient(array_view<const unsigned char> input,
                                    const layer& previous_layer);
 
+    /**
+     * @brief Calculate the gradient of the output layer for a batch (Backpropagation)
+     * @param inputs Inputs of the last batch forward pass (one sample per row)
+     * @param expected_outputs Expected outputs (one sample per row)
+     * @details The weight gradient is accumulated with one deltas^T x inputs product
+     */
+    void calculate_output_gradient(const matrix& inputs, const matrix& expected_outputs);
+
+    /**
+     * @brief Calculate the gradient of the output layer for a batch of byte inputs (Backpropagation)
+     * @param inputs Inputs of the last batch forward pass (one sample per row)
+     * @param expected_outputs Expected outputs (one sample per row)
+     */
+    void calculate_output_gradient(const byte_matrix& inputs, const matrix& expected_outputs);
+
+    /**
+     * @brief Calculate the gradient of the output layer for a batch of sparse inputs (Backpropagation)
+     * @param inputs Inputs of the last batch forward pass
+     * @param expected_outputs Expected outputs (one sample per row)
+     * @details Only the gradients of the non zero inputs are updated
+     */
+    void calculate_output_gradient(const sparse_matrix& inputs, const matrix& expected_outputs);
+
+    /**
+     * @brief Calculate the gradient of a hidden layer for a batch (Backpropagation)
+     * @param inputs Inputs of the last batch forward pass (one sample per row)
+     * @param previous_layer Previous layer (the next one in the forward pass)
+     * @details The deltas come from one product with the weights of previous_layer
+     */
+    void calculate_hidden_gradient(const matrix& inputs, const layer& previous_layer);
+
+    /**
+     * @brief Calculate the gradient of a hidden layer for a batch of byte inputs (Backpropagation)
+     * @param inputs Inputs of the last batch forward pass (one sample per row)
+     * @param previous_layer Previous layer (the next one in the forward pass)
+     */
+    void calculate_hidden_gradient(const byte_matrix& inputs, const layer& previous_layer);
+
+    /**
+     * @brief Calculate the gradient of a hidden layer for a batch of sparse inputs (Backpropagation)
+     * @param inputs Inputs of the last batch forward pass
+     * @param previous_layer Previous layer (the next one in the forward pass)
+     * @details Only the gradients of the non zero inputs are updated
+     */
+    void calculate_hidden_gradient(const sparse_matrix& inputs, const layer& previous_layer);
+
+    /**
+     * @brief Calculate the gradient of the output layer for a batch into the buffers of the caller (Backpropagation)
+     * @param inputs Inputs of the last batch forward pass with these buffers
+     * @param expected_outputs Expected outputs (one sample per row)
+     * @param buffers Buffers of the caller (deltas and gradients are written)
+     */
+    void calculate_output_gradient(const matrix& inputs, const matrix& expected_outputs, layer_buffers& buffers) const;
+    void calculate_output_gradient(const byte_matrix& inputs, const matrix& expected_outputs, layer_buffers& buffers) const;
+    void calculate_output_gradient(const sparse_matrix& inputs, const matrix& expected_outputs, layer_buffers& buffers) const;
+
+    /**
+     * @brief Calculate the gradient of a hidden layer for a batch into the buffers of the caller (Backpropagation)
+     * @param inputs Inputs of the last batch forward pass with these buffers
+     * @param previous_layer Previous layer (the next one in the forward pass)
+     * @param previous_buffers Buffers of the caller for the previous layer (its deltas are read)
+     * @param buffers Buffers of the caller (deltas and gradients are written)
+     */
+    void calculate_hidden_gradient(const matrix& inputs, const layer& previous_layer,
+                                   const layer_buffers& previous_buffers, layer_buffers& buffers) const;
+    void calculate_hidden_gradient(const byte_matrix& inputs, const layer& previous_layer,
+                                   const layer_buffers& previous_buffers, layer_buffers& buffers) const;
+    void calculate_hidden_gradient(const sparse_matrix& inputs, const layer& previous_layer,
+                                   const layer_buffers& previous_buffers, layer_buffers& buffers) const;
+
     /**
      * @brief Update the weights of the layer (Backpropagation)
      * @param batch_size Size of the batch
      * @param learning_rate Learning rate
      */
-    void update_weights(int batch_size, double learning_rate);
+    void update_weights(int batch_size, real learning_rate);
+
+    /**
+     * @brief Update the weights of the layer with gradients of the caller (Backpropagation)
+     * @param gradients Buffers of the caller (the gradients are reset)
+     * @param batch_size Size of the batch
+     * @param learning_rate Learning rate
+     */
+    void update_weights(layer_buffers& gradients, int batch_size, real learning_rate);
+
+    /**
+     * @brief Update the weights of the inputs that are non zero in a sparse batch (Backpropagation)
+     * @param gradients Buffers of the caller with the gradients of that batch (the used ones are reset)
+     * @param batch_size Size of the batch
+     * @param learning_rate Learning rate
+     * @param inputs Inputs of the batch, the gradients of every other input are 0
+     * @details Writes far fewer weights than a dense update, so concurrent updates rarely collide
+     */
+    void update_weights(layer_buffers& gradients, int batch_size, real learning_rate, const sparse_matrix& inputs);
+
+    /**
+     * @brief Sum the gradients of several workers and update a range of nodes (Backpropagation)
+     * @param gradients Buffers of each worker, the sum is left in the first one
+     * @param batch_size Size of the whole batch
+     * @param learning_rate Learning rate
+     * @param first_node First node updated
+     * @param last_node One past the last node updated
+     * @details Each row is summed with a pairwise tree while it is in L1, then every gradient
+     * of the range is reset. Disjoint ranges can be updated by different threads at once
+     */
+    void update_weights(const vector<layer_buffers*>& gradients, int batch_size, real learning_rate,
+                        int first_node, int last_node);
 
     /**
      * @brief Initialize the gradient of the layer
      */
     void initialize_gradient();
 
+    /**
+     * @brief Initialize gradients of the caller for this layer
+     * @param gradients Buffers of the caller (the gradients are set to 0 with the size of the layer)
+     */
+    void initialize_gradient(layer_buffers& gradients) const;
+
+    /**
+     * @brief Copy the weights (row by row) and then the bias of the layer to a flat array
+     * @param parameters First element to write (nodes * (inputs + 1) elements)
+     * @return Element after the last one written
+     */
+    real* save_parameters(real* parameters) const;
+
+    /**
+     * @brief Set the weights and the bias of the layer from a flat array (see save_parameters)
+     * @param parameters First element to read
+     * @return Element after the last one read
+     */
+    const real* load_parameters(const real* parameters);
+
+    /**
+     * @brief Copy gradients of this layer to a flat array, in the order of save_parameters
+     * @param gradients Buffers with the gradients
+     * @param flat First element to write (nodes * (inputs + 1) elements)
+     * @return Element after the last one written
+     */
+    accumulator* save_gradient(const layer_buffers& gradients, accumulator* flat) const;
+
+    /**
+     * @brief Set gradients of this layer from a flat array (see save_gradient)
+     * @param flat First element to read
+     * @param gradients Buffers with the gradients
+     * @return Element after the last one read
+     */
+    const accumulator* load_gradient(const accumulator* flat, layer_buffers& gradients) const;
+
     /**
      * @brief Free the gradient of the layer
      */
@@ -224,7 +489,7 @@ public:
      * @return Cost of the node
      * @details Mean squared error
      */
-    static double node_cost(double output, double expected_output) ;
+    static real node_cost(real output, real expected_output) ;
 
     /**
      * @brief Calculate the derivative of the cost of a node
@@ -232,7 +497,7 @@ public:
      * @param expected_output Expected output of the node
      * @return Derivative of the cost of the node
      */
-    static double d_node_cost(double output, double expected_output) ;
+    static real d_node_cost(real output, real expected_output) ;
 
     /**
      * @brief Copy operator
@@ -245,10 +510,65 @@ public:
 private:
 
     /**
-     * @brief Random double between 0 and 1
-     * @return Random double
+     * @brief Calculate the deltas of the output layer and add them to the bias gradients
+     * @param expected_outputs Expected outputs
+     */
+    void calculate_output_deltas(const vector<real>& expected_outputs);
+
+    /**
+     * @brief Calculate the deltas of a hidden layer and add them to the bias gradients
+     * @param previous_layer Previous layer (the next one in the forward pass)
+     */
+    void calculate_hidden_deltas(const layer& previous_layer);
+
+    /**
+     * @brief Add deltas x input to the weight gradients
+     * @param input Input vector
+     */
+    void add_weight_gradients(array_view<const real> input);
+
+    /**
+     * @brief Add deltas x (input * input scale) to the weight gradients
+     * @param input Input vector
+     */
+    void add_weight_gradients(array_view<const unsigned char> input);
+
+    /**
+     * @brief Batch version of calculate_output_deltas
+     * @param expected_outputs Expected outputs (one sample per row)
+     * @param buffers Buffers with the outputs of the batch (the deltas are written)
+     */
+    void calculate_batch_output_deltas(const matrix& expected_outputs, layer_buffers& buffers) const;
+
+    /**
+     * @brief Batch version of calculate_hidden_deltas
+     * @param previous_layer Previous layer (the next one in the forward pass)
+     * @param previous_buffers Buffers of the previous layer (its deltas are read)
+     * @param buffers Buffers with the outputs of the batch (the deltas are written)
+     */
+    void calculate_batch_hidden_deltas(const layer& previous_layer, const layer_buffers& previous_buffers,
+                                       layer_buffers& buffers) const;
+
+    /**
+     * @brief Call a function on ranges of nodes, split across the thread pool if the layer is big enough
+     * @param function Function called with (first node, one past the last node)
+     */
+    template <class Function>
+    void for_nodes(const Function& function) const {
+        if(pool == nullptr || pool->size() == 1 || (long)nodes * inputs < parallel_threshold){
+            function(0, nodes);
+            return;
+        }
+
+        const int threads = pool->size();
+        pool->run([&](int t){function(nodes * t / threads, nodes * (t + 1) / threads);});
+    }
+
+    /**
+     * @brief Random real between -1 and 1
+     * @return Random real
      */
-    static double random_double();
+    static real random_real();
 };
 
 
@@ -0,0 +1,187 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <algorithm>
+
+#include "aligned.h"
+#include "precision.h"
+#include "sparse.h"
+
+using namespace std;
+
+/**
+ * @brief Dense row-major matrix stored in one cache line aligned buffer
+ * @details Every row is padded up to a whole number of cache lines (the stride),
+ * so each row starts aligned and the padding is always zero
+ */
+template <class T>
+class basic_matrix {
+private:
+    aligned_vector<T> values; //*< Elements of the matrix, row after row */
+    int rows, cols, stride; //*< Number of rows, columns and elements between rows */
+
+public:
+    /**
+     * @brief Constructor
+     * @param rows Number of rows
+     * @param cols Number of columns
+     * @param value Initial value of every element
+     */
+    explicit basic_matrix(int rows = 0, int cols = 0, T value = 0)
+        : rows(rows), cols(cols), stride(padded_size<T>(cols)) {
+        values.assign((size_t)rows * stride, 0);
+        fill(value);
+    }
+
+    [[nodiscard]] inline int get_rows() const {return rows;};
+    [[nodiscard]] inline int get_cols() const {return cols;};
+    [[nodiscard]] inline int get_stride() const {return stride;};
+    [[nodiscard]] inline bool empty() const {return values.empty();};
+
+    [[nodiscard]] inline T* data() {return values.data();};
+    [[nodiscard]] inline const T* data() const {return values.data();};
+
+    /**
+     * @brief Get a row of the matrix
+     * @param row Index of the row
+     */
+    [[nodiscard]] inline array_view<T> row(int row) {
+        return array_view<T>(values.data() + (size_t)row * stride, cols);
+    };
+
+    /**
+     * @brief Get a row of the matrix (read only)
+     * @param row Index of the row
+     */
+    [[nodiscard]] inline array_view<const T> row(int row) const {
+        return array_view<const T>(values.data() + (size_t)row * stride, cols);
+    };
+
+    inline T& operator()(int row, int col) {return values[(size_t)row * stride + col];};
+    inline T operator()(int row, int col) const {return values[(size_t)row * stride + col];};
+
+    /**
+     * @brief Set every element (padding excluded) to a value
+     * @param value Value
+     */
+    void fill(T value) {
+        for(int i = 0; i < rows; i++)
+            std::fill(row(i).begin(), row(i).end(), value);
+    }
+
+    /**
+     * @brief Resize the matrix keeping the existing elements
+     * @param new_rows New number of rows
+     * @param new_cols New number of columns
+     * @details New elements are set to 0. Adding a column only moves memory when
+     * the row runs out of padding
+     */
+    void resize(int new_rows, int new_cols) {
+        int new_stride = padded_size<T>(new_cols);
+
+        if(new_stride != stride) {
+            aligned_vector<T> aux((size_t)new_rows * new_stride, 0);
+            for(int i = 0; i < min(rows, new_rows); i++)
+                copy_n(values.data() + (size_t)i * stride, min(cols, new_cols),
+                       aux.data() + (size_t)i * new_stride);
+            values.swap(aux);
+        }
+        else {
+            values.resize((size_t)new_rows * stride, 0);
+            //Clear the columns that are removed so the padding stays zero
+            for(int i = 0; i < new_rows && new_cols < cols; i++)
+                std::fill(values.data() + (size_t)i * stride + new_cols,
+                          values.data() + (size_t)i * stride + cols, 0);
+        }
+
+        rows = new_rows;
+        cols = new_cols;
+        stride = new_stride;
+    }
+
+    /**
+     * @brief Free the memory of the matrix
+     */
+    void clear() {
+        values = {};
+        rows = cols = 0;
+        stride = padded_size<T>(0);
+    }
+};
+
+typedef basic_matrix<real> matrix; //*< Matrix of weights, inputs, outputs or deltas */
+typedef basic_matrix<accumulator> gradient_matrix; //*< Matrix of accumulated gradients */
+typedef basic_matrix<unsigned char> byte_matrix; //*< Matrix of raw inputs (e.g. pixels) */
+
+/**
+ * @brief Matrix product c = f(a * b^T + bias), cache tiled
+ * @param a Left matrix (rows x k), e.g. one input sample per row
+ * @param b Right matrix (cols x k), e.g. one row of weights per node
+ * @param c Result (rows x cols), resized if needed
+ * @param bias Value added to every column of c before the function (optional)
+ * @param function Function applied to every element of c once it is final (optional)
+ * @details Every element is computed with the dot kernel starting from the bias,
+ * so results match the matrix-vector path exactly
+ */
+void multiply_transposed(const matrix& a, const matrix& b, matrix& c,
+                         const real* bias = nullptr, real (*function)(real) = nullptr);
+
+/**
+ * @brief Matrix product c = f((a * scale) * b^T + bias) with byte inputs
+ * @param scale Factor applied to every element of a when it is widened in registers
+ * @details Same as converting a to real first, without the intermediate real matrix
+ */
+void multiply_transposed(const byte_matrix& a, real scale, const matrix& b, matrix& c,
+                         const real* bias = nullptr, real (*function)(real) = nullptr);
+
+/**
+ * @brief Matrix product c = a * b, cache tiled
+ * @param a Left matrix (rows x k), e.g. the deltas of the next layer, one sample per row
+ * @param b Right matrix (k x cols), e.g. the weights of the next layer
+ * @param c Result (rows x cols), resized if needed
+ * @details Rows of b are streamed contiguously (no column walks) with the axpy kernel.
+ * Every element is accumulated in increasing k
+ */
+void multiply(const matrix& a, const matrix& b, matrix& c);
+
+/**
+ * @brief Transposed matrix-vector product y = a^T * x
+ * @param a Matrix (k x cols), e.g. the weights of the next layer
+ * @param x Vector (k elements), e.g. the deltas of the next layer
+ * @param y Result (cols elements)
+ * @details Adds the rows of a scaled by x with the axpy kernel instead of walking its
+ * columns. Every element is accumulated in increasing k, like multiply
+ */
+void transposed_multiply(const matrix& a, array_view<const real> x, array_view<real> y);
+
+/**
+ * @brief Matrix product c += a^T * b, cache tiled
+ * @param a Left matrix (k x rows), e.g. the deltas of a layer, one sample per row
+ * @param b Right matrix (k x cols), e.g. the inputs of a layer, one sample per row
+ * @param c Accumulated result (rows x cols), must already have that size
+ * @details The k rank-1 updates are added in increasing k, so accumulating a batch
+ * matches accumulating its samples one by one
+ */
+void transposed_multiply_add(const matrix& a, const matrix& b, gradient_matrix& c);
+
+/**
+ * @brief Matrix product c += a^T * (b * scale) with byte inputs
+ * @param scale Factor applied to every element of b when it is widened in registers
+ */
+void transposed_multiply_add(const matrix& a, const byte_matrix& b, real scale, gradient_matrix& c);
+
+/**
+ * @brief Matrix product c = f((a * scale) * b^T + bias) with sparse byte inputs
+ * @details Only the columns of b matching non zero elements of a are read. With the scalar
+ * kernels the result is the same as the dense version
+ */
+void multiply_transposed(const sparse_matrix& a, real scale, const matrix& b, matrix& c,
+                         const real* bias = nullptr, real (*function)(real) = nullptr);
+
+/**
+ * @brief Matrix product c += a^T * (b * scale) with sparse byte inputs
+ * @details Only the columns of c matching non zero elements of b are updated
+ */
+void transposed_multiply_add(const matrix& a, const sparse_matrix& b, real scale, gradient_matrix& c);
+
+#endif
@@ -4,9 +4,44 @@
 #include <fstream>
 #include <vector>
 
+#include "augmentation.h"
 #include "layer.h"
 #include "data_set.h"
 
+class shm_all_reduce;
+class parameter_server;
+class streaming_data_set;
+
+/**
+ * @brief Buffers for an allocation free forward pass
+ * @details Sized on the first use (or by n_network::prepare_workspace). Reusing it for
+ * more inputs of the same network performs no heap allocation
+ */
+struct inference_workspace {
+    vector<aligned_vector<real>> outputs; //*< Outputs of each layer */
+};
+
+/**
+ * @brief Buffers of one training thread
+ * @details Sized by n_network::prepare_buffers. Each thread computes the gradient of its
+ * slice of a batch into its own buffers, the network is only read
+ */
+struct training_buffers {
+    vector<layer_buffers> layers; //*< Batch outputs, deltas and gradients of each layer */
+    byte_matrix inputs; //*< Inputs of the slice of the batch */
+    sparse_buffer sparse; //*< Sparse inputs of the slice of the batch when shuffled */
+    augment_workspace augment; //*< Buffers of the random transforms of the inputs */
+    matrix expected; //*< Expected outputs of the slice of the batch */
+};
+
+/**
+ * @brief Order in which a stage of learn_pipeline runs the micro-batches of a batch
+ */
+enum class pipeline_schedule {
+    gpipe, //*< Every forward pass, then every backward pass (activations of the whole batch in flight) */
+    one_f_one_b //*< One forward pass, one backward pass (at most one micro-batch per stage in flight) */
+};
+
 /**
  * @brief Class that represents a neural network
  */
@@ -14,6 +49,14 @@ class n_network {
 private:
     vector<layer> layers; //*< Layers of the network */
     int num_layers, num_inputs, num_outputs; //*< Number of layers, inputs and outputs of the network */
+    double sparse_threshold; //*< Highest input density of a batch that uses the sparse path (negative: automatic) */
+    int threads; //*< Number of threads used by learn (0: one per hardware thread) */
+    int deterministic_chunk; //*< Samples per slice of a batch in deterministic mode (0: one slice per thread) */
+    int prefetch_depth, prefetch_threads; //*< Batches loaded ahead by each loader thread (0: no loader) and loader threads */
+    int shuffle_block, shuffle_window; //*< Samples of each block and blocks of each window of the epoch shuffle (0: file order) */
+    unsigned shuffle_seed; //*< Seed of the epoch shuffle */
+    augmentation augment_settings; //*< Random transforms of the training samples of learn */
+    unsigned augment_seed; //*< Seed of the random transforms */
  
 public:
     /**
@@ -64,6 +107,122 @@ public:
      */
     [[nodiscard]] const layer& get_layer(int layer) const {return layers[layer];};
 
+    /**
+     * @brief Get the factor applied to byte inputs (e.g. pixels)
+     */
+    [[nodiscard]] real get_input_scale() const {return layers[0].get_input_scale();};
+
+    /**
+     * @brief Set the factor applied to byte inputs (default 1, e.g. 1/255 to normalize pixels)
+     * @param scale Factor
+     */
+    void set_input_scale(real scale);
+
+    /**
+     * @brief Get the number of threads used by learn
+     */
+    [[nodiscard]] int get_threads() const {return threads;};
+
+    /**
+     * @brief Set the number of threads used by learn (default 1)
+     * @param num_threads Number of threads (0 uses one per hardware thread)
+     * @details Each thread computes the gradient of a slice of every batch
+     */
+    void set_threads(int num_threads) {threads = max(0, num_threads);};
+
+    /**
+     * @brief Check if learn gives the same result for any number of threads
+     */
+    [[nodiscard]] bool is_deterministic() const {return deterministic_chunk > 0;};
+
+    /**
+     * @brief Make learn give bit-identical results for any number of threads (default off)
+     * @param deterministic Deterministic mode
+     * @param chunk_size Samples of each slice of a batch
+     * @details Batches are split in slices of chunk_size samples instead of one slice per thread.
+     * Each slice has its own gradients and they are summed with the same pairwise tree whatever
+     * thread computed them. Results depend on the chunk size (and srand), not on the threads.
+     * Smaller chunks let more threads work on small batches, larger ones use fewer buffers
+     * (with the default size it costs about 1% of the throughput of the default mode).
+     * It does not apply to learn_hogwild
+     */
+    void set_deterministic(bool deterministic, int chunk_size = 16) {deterministic_chunk = deterministic ? max(1, chunk_size) : 0;};
+
+    /**
+     * @brief Load the next batches of learn on background threads while the current one trains (default 2, 1)
+     * @param depth Batches loaded ahead by each loader thread (2: double buffering, 0: the training
+     * threads load their own slices)
+     * @param loader_threads Loader threads
+     * @details The result does not change, only where the inputs and expected outputs are gathered
+     */
+    void set_prefetch(int depth, int loader_threads = 1) {prefetch_depth = max(0, depth); prefetch_threads = max(1, loader_threads);};
+
+    /**
+     * @brief Get the number of batches loaded ahead by each loader thread of learn (0: no loader)
+     */
+    [[nodiscard]] int get_prefetch() const {return prefetch_depth;};
+
+    /**
+     * @brief Make learn visit the samples in a new order every epoch (default off: file order)
+     * @param shuffle Shuffle the samples
+     * @param seed Seed of the shuffle, the same seed gives the same orders
+     * @param block_samples Samples of each block of consecutive samples (see epoch_sampler)
+     * @param window_blocks Blocks of each window the samples are shuffled within
+     * @details Still bit-identical for any number of threads in deterministic mode and with or
+     * without prefetching. Streamed datasets are shuffled within each window too
+     */
+    void set_shuffle(bool shuffle, unsigned seed = 1, int block_samples = 64, int window_blocks = 8) {
+        shuffle_block = shuffle ? max(1, block_samples) : 0;
+        shuffle_window = max(1, window_blocks);
+        shuffle_seed = seed;
+    };
+
+    /**
+     * @brief Check if learn shuffles the samples every epoch
+     */
+    [[nodiscard]] bool is_shuffled() const {return shuffle_block > 0;};
+
+    /**
+     * @brief Make learn transform every training sample at random when it is loaded (default none)
+     * @param settings Transforms (see augmentation), rows * cols must match the samples
+     * @param seed Seed of the transforms
+     * @details The transforms run where the batches are gathered: on the loader threads when
+     * prefetching (see set_prefetch), on the training threads otherwise. Every sample gets new
+     * transforms each epoch, and the result is still the same for any number of threads in
+     * deterministic mode and with or without prefetching. Transformed samples skip the sparse path
+     */
+    void set_augmentation(const augmentation& settings, unsigned seed = 1) {
+        augment_settings = settings;
+        augment_seed = seed;
+    };
+
+    /**
+     * @brief Get the random transforms of the training samples
+     */
+    [[nodiscard]] const augmentation& get_augmentation() const {return augment_settings;};
+
+    /**
+     * @brief Share the nodes of the big layers across a thread pool (see layer::set_thread_pool)
+     * @param pool Pool (not owned, null to run every layer on the caller)
+     * @param threshold Fewest weights of a layer for which the pool is used
+     * @details Cuts the latency of a single input, e.g. in calculate_outputs with a workspace.
+     * A pool busy with another call runs the layer on the caller, so the result never changes
+     */
+    void set_thread_pool(thread_pool* pool, long threshold = layer::PARALLEL_THRESHOLD);
+
+    /**
+     * @brief Get the highest input density that uses the sparse input path
+     * @details By default it depends on the instruction set of the kernels
+     */
+    [[nodiscard]] double get_sparse_threshold() const;
+
+    /**
+     * @brief Set the highest input density that uses the sparse input path
+     * @param threshold Fraction of non zero inputs (0 disables the sparse path, negative restores the default)
+     * @details Only used by learn and cost with datasets that have sparse inputs (data_set::build_sparse)
+     */
+    void set_sparse_threshold(double threshold) {sparse_threshold = threshold;};
+
     /**
      * @brief Set the activation function of the hidden layers
      * @param new_activation New activation function
@@ -126,7 +285,48 @@ public:
      * @param input Input vector
      * @return Output vector
      */
-    vector<double> calculate_outputs(const vector<unsigned char>& input);
+    vector<real> calculate_outputs(const vector<unsigned char>& input);
+
+    /**
+     * @brief Calculate the outputs of the network for a batch (Forward pass)
+     * @param inputs Input matrix (one sample per row)
+     * @return Output matrix (one sample per row), valid until the next batch forward pass
+     * @details Each layer does one matrix-matrix product, so its weights are read
+     * once per batch instead of once per sample
+     */
+    const matrix& calculate_outputs(const matrix& inputs);
+
+    /**
+     * @brief Calculate the outputs of the network for a batch of byte inputs (Forward pass)
+     * @param inputs Input matrix (one sample per row)
+     * @return Output matrix (one sample per row), valid until the next batch forward pass
+     */
+    const matrix& calculate_outputs(const byte_matrix& inputs);
+
+    /**
+     * @brief Calculate the outputs of the network for a batch of sparse byte inputs (Forward pass)
+     * @param inputs Non zero inputs of each sample
+     * @return Output matrix (one sample per row), valid until the next batch forward pass
+     * @details The first layer only reads the weights of the non zero inputs
+     */
+    const matrix& calculate_outputs(const sparse_matrix& inputs);
+
+    /**
+     * @brief Calculate the outputs of the network into a workspace (Forward pass)
+     * @param input Input vector
+     * @param workspace Buffers of the caller, sized on first use
+     * @return View of the output, valid until the workspace is used again
+     * @details Does not modify the network and does not allocate after the first call,
+     * so several threads can run inference on one network with their own workspaces
+     */
+    array_view<const real> calculate_outputs(array_view<const unsigned char> input,
+                                             inference_workspace& workspace) const;
+
+    /**
+     * @brief Size the buffers of a workspace for this network
+     * @param workspace Workspace
+     */
+    void prepare_workspace(inference_workspace& workspace) const;
 
     /**
      * @brief Calculate the cost of an input
@@ -134,7 +334,15 @@ public:
      * @param expected_output Expected output vector
      * @return Cost of the network
      */
-    double cost(const vector<unsigned char>& input, const vector<double>& expected_output);
+    accumulator cost(const vector<unsigned char>& input, const vector<real>& expected_output);
+
+    /**
+     * @brief Calculate the total cost of a batch
+     * @param inputs Input matrix (one sample per row)
+     * @param expected_outputs Expected output matrix (one sample per row)
+     * @return Sum of the costs of the samples
+     */
+    accumulator cost(const matrix& inputs, const matrix& expected_outputs);
 
     /**
      * @brief Calculate the cost of a dataset
@@ -143,30 +351,178 @@ public:
      * @param batch_size Batch size
      * @return Cost of the dataset
      */
-    double cost(const data_set& dataset, int start_pos = 0, int batch_size = 100);
+    accumulator cost(const data_set& dataset, int start_pos = 0, int batch_size = 100);
 
     /**
      * @brief Calculate the gradient of the network (Backpropagation)
      * @param input Input vector
      * @param expected_output Expected output vector
      */
-    void calculate_gradient(const vector<unsigned char>& input, const vector<double>& expected_output);
+    void calculate_gradient(const vector<unsigned char>& input, const vector<real>& expected_output);
+
+    /**
+     * @brief Calculate the gradient of a whole batch (Backpropagation)
+     * @param inputs Input matrix (one sample per row)
+     * @param expected_outputs Expected output matrix (one sample per row)
+     * @details Forward and backward passes are matrix products over the batch. The
+     * accumulated gradients match calling calculate_gradient on each sample in order
+     */
+    void calculate_gradient(const matrix& inputs, const matrix& expected_outputs);
+
+    /**
+     * @brief Calculate the gradient of a whole batch of byte inputs (Backpropagation)
+     * @param inputs Input matrix (one sample per row)
+     * @param expected_outputs Expected output matrix (one sample per row)
+     */
+    void calculate_gradient(const byte_matrix& inputs, const matrix& expected_outputs);
+
+    /**
+     * @brief Calculate the gradient of a whole batch of sparse byte inputs (Backpropagation)
+     * @param inputs Non zero inputs of each sample
+     * @param expected_outputs Expected output matrix (one sample per row)
+     * @details The first layer only updates the gradients of the non zero inputs
+     */
+    void calculate_gradient(const sparse_matrix& inputs, const matrix& expected_outputs);
+
+    /**
+     * @brief Size the buffers of a training thread for this network (the gradients are set to 0)
+     * @param buffers Buffers of the thread
+     */
+    void prepare_buffers(training_buffers& buffers) const;
+
+    /**
+     * @brief Calculate the gradient of consecutive samples of a dataset into buffers of the caller (Backpropagation)
+     * @param dataset Dataset
+     * @param start_pos First sample
+     * @param size Number of samples
+     * @param buffers Buffers of the caller, the gradients are added to them
+     * @param order Index of the sample at each position (start_pos indexes it), null for file order
+     * @param augment Random transforms of the inputs, null for none
+     * @param round Round of the random transforms (see augmenter::key)
+     * @details Does not modify the network, so several threads can compute the gradients of
+     * different samples at once with their own buffers
+     */
+    void calculate_gradient(const data_set& dataset, int start_pos, int size, training_buffers& buffers,
+                            const int* order = nullptr, const augmenter* augment = nullptr,
+                            unsigned long long round = 0) const;
 
     /**
      * @brief Update the weights of the network (Backpropagation)
      * @param batch_size Size of the batch
      * @param learning_rate Learning rate
      */
-    void update_weights(int batch_size, double learning_rate);
+    void update_weights(int batch_size, real learning_rate);
 
     /**
      * @brief Learn from a dataset
+     * @details Each batch of consecutive samples is split in one slice per thread (or in fixed
+     * chunks, see set_deterministic). The gradient of each slice is computed as one matrix into
+     * its own buffers, then every thread sums the gradients of a slice of the nodes of each
+     * layer and updates their weights
+     * @param dataset Dataset
+     * @param batch_size Size of the batch
+     * @param learning_rate Learning rate
+     * @param epochs Number of epochs
+     */
+    void learn(const data_set& dataset, int batch_size = 100, real learning_rate = 0.5, int epochs = 1);
+
+    /**
+     * @brief Learn from a dataset streamed from disk (see learn)
+     * @details Batches are taken from each window of the stream, so only a window of the
+     * dataset is in memory. The costs printed are the ones of the first and last windows
+     * @param dataset Stream, rewound at the start of each epoch
+     * @param batch_size Size of the batch
+     * @param learning_rate Learning rate
+     * @param epochs Number of epochs
+     */
+    void learn(streaming_data_set& dataset, int batch_size = 100, real learning_rate = 0.5, int epochs = 1);
+
+    /**
+     * @brief Learn from a dataset with asynchronous lock-free updates (Hogwild)
+     * @details Every thread takes the next batch, computes its gradient into its own buffers
+     * and applies it straight to the shared weights, without locks or waiting for the other
+     * threads. Reads and writes of the weights race on purpose: a thread may see a mix of old
+     * and new weights, and a concurrent update of the same weight may be lost. Batches with
+     * sparse inputs only write the first layer weights of their non zero inputs, so collisions
+     * are rare. With one thread it matches learn exactly
+     * @param dataset Dataset
+     * @param batch_size Size of the batch of each thread
+     * @param learning_rate Learning rate
+     * @param epochs Number of epochs
+     */
+    void learn_hogwild(const data_set& dataset, int batch_size = 100, real learning_rate = 0.5, int epochs = 1);
+
+    /**
+     * @brief Learn from a dataset with the layers split in a pipeline of threads
+     * @details Each thread (stage) owns a group of consecutive layers. Every batch is split in
+     * micro-batches that go forward through the stages, and their deltas come back, through
+     * bounded lock-free queues, so all the stages work at once on different micro-batches.
+     * Weights are only updated after a flush at the end of each batch: every micro-batch of a
+     * batch sees the same weights in its forward and backward pass, there is no staleness and
+     * no weight stashing. Each stage adds the gradients of the micro-batches in order, so the
+     * result is the same as learn with one thread. Uses min(threads, layers) stages
      * @param dataset Dataset
      * @param batch_size Size of the batch
      * @param learning_rate Learning rate
      * @param epochs Number of epochs
+     * @param micro_batch Samples of each micro-batch
+     * @param schedule Order of the forward and backward passes of each stage
+     */
+    void learn_pipeline(const data_set& dataset, int batch_size = 100, real learning_rate = 0.5, int epochs = 1,
+                        int micro_batch = 16, pipeline_schedule schedule = pipeline_schedule::one_f_one_b);
+
+    /**
+     * @brief Learn from a dataset together with other processes (multi-process data parallelism)
+     * @details Every process of the group runs it with the same network and dataset. Each one
+     * takes its shard of every batch (a slice of consecutive samples per rank), computes its
+     * gradient and sums the gradients of every process through the shared memory of the group
+     * (ring all-reduce). All processes then apply the same update, so their networks stay
+     * identical. Only rank 0 prints the costs. Every batch costs one all-reduce of the whole
+     * gradient, so the batch has to be large (hundreds of samples) for the computation of
+     * each shard to outweigh the communication, with small batches more processes are slower.
+     * If a process fails the group is aborted and the others throw runtime_error
+     * @param dataset Dataset
+     * @param batch_size Size of the batch (of the whole group)
+     * @param learning_rate Learning rate
+     * @param epochs Number of epochs
+     * @param group Processes that train together, created with gradient_size elements
+     */
+    void learn_distributed(const data_set& dataset, int batch_size, real learning_rate, int epochs,
+                           shm_all_reduce& group);
+
+    /**
+     * @brief Learn from a dataset with a parameter server and asynchronous workers
+     * @details Every process of the group runs it with the same network and dataset. The server
+     * (rank 0) holds the master copy of the weights and applies each gradient as soon as it
+     * arrives. Each worker takes its own shard of the dataset (consecutive samples) and, for
+     * every batch of it, pulls the weights, computes the gradient and pushes it. A worker only
+     * waits for the others when it gets more batches ahead of the slowest one than the
+     * staleness of the group allows. At the end the server network has the trained weights
+     * @param dataset Dataset
+     * @param batch_size Size of the batch of each worker
+     * @param learning_rate Learning rate
+     * @param epochs Number of epochs of each worker over its shard
+     * @param group Server and workers, the server must not be one of the workers
+     */
+    void learn_parameter_server(const data_set& dataset, int batch_size, real learning_rate, int epochs,
+                                parameter_server& group);
+
+    /**
+     * @brief Number of gradients of the network (weights and bias of every layer)
+     */
+    [[nodiscard]] size_t gradient_size() const;
+
+    /**
+     * @brief Copy the weights and bias of every layer to a flat array
+     * @param parameters Result (gradient_size elements)
+     */
+    void get_parameters(array_view<real> parameters) const;
+
+    /**
+     * @brief Set the weights and bias of every layer from a flat array (see get_parameters)
+     * @param parameters Parameters (gradient_size elements)
      */
-    void learn(const data_set& dataset, int batch_size = 100, double learning_rate = 0.5, int epochs = 1);
+    void set_parameters(array_view<const real> parameters);
 
     /**
      * @brief Copy operator
@@ -174,6 +530,64 @@ public:
      * @return Copied neural network
      */
     n_network& operator=(const n_network& other);
+
+private:
+    /**
+     * @brief Check if a batch of a dataset goes through the sparse input path
+     * @param dataset Dataset
+     * @param start_pos First sample of the batch
+     * @param batch_size Size of the batch
+     */
+    [[nodiscard]] bool use_sparse(const data_set& dataset, int start_pos, int batch_size) const;
+
+    /**
+     * @brief One-hot expected outputs of consecutive samples of a dataset
+     * @param dataset Dataset
+     * @param start_pos First sample
+     * @param size Number of samples
+     * @param expected Result (one sample per row), resized if needed
+     */
+    void load_expected(const data_set& dataset, int start_pos, int size, matrix& expected) const;
+
+    /**
+     * @brief Copy the gradients of every layer to a flat array (in the order of get_parameters)
+     * @param buffers Buffers with the gradients
+     * @param gradients Result (gradient_size elements)
+     */
+    void save_gradient(const training_buffers& buffers, array_view<accumulator> gradients) const;
+
+    /**
+     * @brief Set the gradients of every layer from a flat array (see save_gradient)
+     * @param gradients Gradients (gradient_size elements)
+     * @param buffers Buffers with the gradients
+     */
+    void load_gradient(array_view<const accumulator> gradients, training_buffers& buffers) const;
+
+    /**
+     * @brief learn over the windows of a dataset
+     * @param windows Source of windows: rewind starts an epoch, next gives the next window
+     * (a data_set valid until the following call, the last one until rewind) or null at the end
+     */
+    template <class Windows>
+    void learn_windows(Windows& windows, int batch_size, real learning_rate, int epochs);
+
+    /**
+     * @brief Batch forward pass for any type of input matrix
+     */
+    template <class Inputs>
+    const matrix& batch_outputs(const Inputs& inputs);
+
+    /**
+     * @brief Batch backpropagation for any type of input matrix
+     */
+    template <class Inputs>
+    void batch_gradient(const Inputs& inputs, const matrix& expected_outputs);
+
+    /**
+     * @brief Batch backpropagation into buffers of the caller for any type of input matrix
+     */
+    template <class Inputs>
+    void batch_gradient(const Inputs& inputs, const matrix& expected_outputs, vector<layer_buffers>& buffers) const;
 };
 
 
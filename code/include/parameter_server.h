@@ -0,0 +1,136 @@
+#ifndef PARAMETER_SERVER_H
+#define PARAMETER_SERVER_H
+
+#include <vector>
+
+#include "aligned.h"
+#include "gradient_compression.h"
+#include "precision.h"
+
+using namespace std;
+
+/**
+ * @brief Processes of one machine that train through a parameter server over Unix domain sockets
+ * @details Rank 0 (the server) holds the master copy of the parameters and forks the workers
+ * (ranks 1 to workers), each connected to it by its own socket. A worker pulls the parameters,
+ * computes a gradient and pushes it; the server applies every gradient as soon as it arrives,
+ * so workers never wait for each other. Staleness is bounded: a worker that has pushed more
+ * than staleness gradients more than the slowest unfinished worker does not get new parameters
+ * (and so waits) until the slowest one catches up. Gradients can be compressed before they
+ * are sent (see gradient_compressor), the parameters are always sent as they are
+ */
+class parameter_server {
+private:
+    /**
+     * @brief Header of every message
+     */
+    struct message {
+        int type; //*< Parameters, gradients or finished */
+        int batch_size; //*< Samples of the gradients */
+        long version; //*< Updates applied to the parameters */
+        long bytes; //*< Size of the data after the header */
+    };
+
+    enum {parameters_message, gradients_message, finished_message};
+
+    int rank, workers, staleness; //*< Index of this process, number of workers and staleness bound */
+    vector<int> sockets; //*< Server: socket of each worker, worker: socket of the server */
+    vector<int> children; //*< Processes forked by the server */
+
+    gradient_compressor compressor; //*< Encoding of the gradients (worker: compresses, server: decompresses) */
+    vector<unsigned char> packed; //*< Encoded gradients of the last message */
+
+    vector<long> clocks; //*< Gradients pushed by each worker (server only) */
+    vector<long> pulled; //*< Version of the parameters each worker is using (server only) */
+    vector<bool> waiting, finished; //*< Workers waiting for parameters and workers done (server only) */
+    int last_served; //*< Worker whose gradient was received last (server only) */
+    long version; //*< Updates applied to the parameters last released (server only) */
+    long max_delay; //*< Largest number of updates a gradient missed (server only) */
+    long pushes, pushed_bytes; //*< Gradients received and their encoded size (server only) */
+
+public:
+    /**
+     * @brief Create the sockets of a group of processes
+     * @param workers Number of worker processes
+     * @param staleness Most gradients a worker can push ahead of the slowest one (0: lockstep)
+     * @param method Encoding of the gradients sent by the workers
+     * @param top_k_ratio Fraction of the gradients sent with compression::top_k
+     * @details Call fork_workers afterwards to start the workers
+     */
+    parameter_server(int workers, int staleness, compression method = compression::none, double top_k_ratio = 0.01);
+
+    parameter_server(const parameter_server&) = delete;
+    parameter_server& operator=(const parameter_server&) = delete;
+
+    /**
+     * @brief Destructor, closes the sockets (the server first waits for the workers)
+     */
+    ~parameter_server();
+
+    /**
+     * @brief Fork the worker processes
+     * @return Rank of the calling process (0 is the server)
+     * @details Everything built before (e.g. the network and the dataset) is the same in every rank
+     */
+    int fork_workers();
+
+    [[nodiscard]] int get_rank() const {return rank;};
+    [[nodiscard]] int get_workers() const {return workers;};
+    [[nodiscard]] int get_staleness() const {return staleness;};
+
+    /**
+     * @brief Largest number of updates applied between the pull and the push of a gradient (server only)
+     */
+    [[nodiscard]] long get_max_delay() const {return max_delay;};
+
+    /**
+     * @brief Average bytes of the gradients sent by a worker for one batch (server only)
+     */
+    [[nodiscard]] double get_bytes_per_push() const {return pushes > 0 ? (double)pushed_bytes / pushes : 0;};
+
+    /**
+     * @brief Encoding of the gradients
+     */
+    [[nodiscard]] compression get_compression() const {return compressor.get_method();};
+
+    /**
+     * @brief Wait for the parameters (worker only)
+     * @param parameters Result
+     */
+    void pull(array_view<real> parameters);
+
+    /**
+     * @brief Send a gradient to the server (worker only)
+     * @param gradients Gradients computed with the last parameters pulled
+     * @param batch_size Samples of the gradients
+     */
+    void push(array_view<const accumulator> gradients, int batch_size);
+
+    /**
+     * @brief Tell the server this worker is done (worker only)
+     */
+    void finish();
+
+    /**
+     * @brief Wait for the next gradient of any worker (server only)
+     * @param gradients Result
+     * @param batch_size Samples of the gradients (0 if the worker has just finished)
+     * @return Rank of the worker, or 0 once every worker has finished
+     * @details Call release after each one, the update or the end of a worker may let others go on
+     */
+    int receive(array_view<accumulator> gradients, int& batch_size);
+
+    /**
+     * @brief Send the parameters to the waiting workers within the staleness bound (server only)
+     * @param parameters Parameters
+     * @param version Updates applied to the parameters
+     */
+    void release(array_view<const real> parameters, long version);
+
+    /**
+     * @brief Check if parameter servers can be used on this system
+     */
+    static bool supported();
+};
+
+#endif
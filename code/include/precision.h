@@ -0,0 +1,20 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+// Floating point types of the network, chosen at build time (see NN_REAL and
+// NN_ACCUMULATOR in CMakeLists.txt)
+
+#ifndef NN_REAL
+#define NN_REAL double
+#endif
+
+#ifndef NN_ACCUMULATOR
+#define NN_ACCUMULATOR NN_REAL
+#endif
+
+typedef NN_REAL real; //*< Type of weights, biases, inputs and outputs */
+typedef NN_ACCUMULATOR accumulator; //*< Type of dot product sums and of the gradients */
+
+static_assert(sizeof(accumulator) >= sizeof(real), "The accumulator can not be less precise than real");
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef SHM_ALL_REDUCE_H
+#define SHM_ALL_REDUCE_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "aligned.h"
+#include "precision.h"
+
+using namespace std;
+
+/**
+ * @brief Sum of arrays across the processes of one machine through POSIX shared memory
+ * @details The first process creates the shared memory and forks the others (ranks 1 to
+ * world_size - 1), so they share it without any network stack. Every process writes its
+ * array in its own slot and all_reduce sums them with a ring: world_size - 1 reduce-scatter
+ * steps and world_size - 1 all-gather steps, each rank only reading the slot of its left
+ * neighbour, with a barrier between steps. Every rank gets exactly the same result.
+ * A rank that fails calls abort, and rank 0 also watches for ranks that died: the barriers of
+ * every other rank then throw instead of waiting for it forever
+ */
+class shm_all_reduce {
+private:
+    /**
+     * @brief Shared state at the start of the shared memory
+     */
+    struct control {
+        alignas(CACHE_LINE) atomic<int> arrived; //*< Processes waiting in the barrier */
+        alignas(CACHE_LINE) atomic<int> generation; //*< Number of barriers passed */
+        alignas(CACHE_LINE) atomic<int> aborted; //*< Set once a rank failed or died */
+    };
+
+    int rank, world_size; //*< Index of this process and number of processes */
+    size_t count, stride; //*< Elements of each array and elements between slots */
+    size_t bytes; //*< Size of the shared memory */
+    control* shared; //*< Shared memory (control followed by one slot per rank) */
+    vector<int> children; //*< Processes forked by rank 0 */
+    int parent; //*< Process that forked this one (other ranks) */
+    int exited; //*< Children that have exited (rank 0) */
+
+public:
+    /**
+     * @brief Create the shared memory for a group of processes
+     * @param world_size Number of processes
+     * @param count Number of elements summed by all_reduce
+     * @details Call fork_ranks afterwards to start the other processes
+     */
+    shm_all_reduce(int world_size, size_t count);
+
+    shm_all_reduce(const shm_all_reduce&) = delete;
+    shm_all_reduce& operator=(const shm_all_reduce&) = delete;
+
+    /**
+     * @brief Destructor, unmaps the shared memory (rank 0 first waits for the other ranks)
+     */
+    ~shm_all_reduce();
+
+    /**
+     * @brief Fork the other processes of the group
+     * @return Rank of the calling process (0 in the original one)
+     * @details Everything built before (e.g. the network and the dataset) is the same in every rank
+     */
+    int fork_ranks();
+
+    [[nodiscard]] int get_rank() const {return rank;};
+    [[nodiscard]] int get_world_size() const {return world_size;};
+
+    /**
+     * @brief Array of this process, written before all_reduce and read after it
+     */
+    [[nodiscard]] array_view<accumulator> buffer();
+
+    /**
+     * @brief Replace the array of every process by the sum of all of them (ring all-reduce)
+     * @details Every process must call it, it returns once the sum is in its array
+     */
+    void all_reduce();
+
+    /**
+     * @brief Wait until every process of the group gets here
+     * @details Throws runtime_error if a rank aborted or died meanwhile
+     */
+    void barrier();
+
+    /**
+     * @brief Tell every process of the group that this one cannot go on (e.g. it failed)
+     */
+    void abort();
+
+    /**
+     * @brief Check if shared memory groups can be used on this system
+     */
+    static bool supported();
+
+private:
+    /**
+     * @brief Slot of a rank
+     */
+    accumulator* slot(int index) const;
+
+    /**
+     * @brief Check if a rank aborted or exited (rank 0 reaps its children, the others check
+     * that rank 0 is still there)
+     */
+    [[nodiscard]] bool failed();
+};
+
+#endif
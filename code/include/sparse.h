@@ -0,0 +1,47 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+/**
+ * @brief Non zero elements of one byte input (e.g. the lit pixels of an image)
+ */
+struct sparse_vector {
+    const int* indices; //*< Positions of the non zero elements, increasing */
+    const unsigned char* values; //*< Values of the non zero elements */
+    int count; //*< Number of non zero elements */
+};
+
+/**
+ * @brief Rows of byte inputs stored in compressed sparse row (CSR) format, without ownership
+ * @details Row r holds the elements offsets[r] to offsets[r + 1] - 1 of indices/values
+ */
+struct sparse_matrix {
+    const int* offsets; //*< Start of each row (rows + 1 elements) */
+    const int* indices; //*< Column of every non zero element */
+    const unsigned char* values; //*< Value of every non zero element */
+    int rows, cols; //*< Number of rows and columns (of the dense matrix) */
+
+    /**
+     * @brief Get a row
+     * @param row Index of the row
+     */
+    [[nodiscard]] inline sparse_vector row(int row) const {
+        return {indices + offsets[row], values + offsets[row], offsets[row + 1] - offsets[row]};
+    };
+
+    [[nodiscard]] inline int get_rows() const {return rows;};
+    [[nodiscard]] inline int get_cols() const {return cols;};
+
+    /**
+     * @brief Number of non zero elements
+     */
+    [[nodiscard]] inline long non_zeros() const {return rows > 0 ? offsets[rows] - offsets[0] : 0;};
+
+    /**
+     * @brief Fraction of non zero elements
+     */
+    [[nodiscard]] inline double density() const {
+        return rows > 0 && cols > 0 ? (double)non_zeros() / ((double)rows * cols) : 0;
+    };
+};
+
+#endif
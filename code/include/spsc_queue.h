@@ -0,0 +1,91 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "aligned.h"
+
+using namespace std;
+
+/**
+ * @brief Bounded lock-free queue with a single producer and a single consumer
+ * @details Ring buffer whose read and write positions live on their own cache lines. push
+ * and pop never lock, a full or empty queue makes them yield until the other side moves
+ */
+template <class T>
+class spsc_queue {
+private:
+    vector<T> items; //*< Ring buffer (a power of two elements) */
+    size_t mask; //*< Number of elements - 1 */
+
+    alignas(CACHE_LINE) atomic<size_t> head; //*< Next element to pop (written by the consumer) */
+    alignas(CACHE_LINE) atomic<size_t> tail; //*< Next element to push (written by the producer) */
+
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Fewest elements the queue can hold (rounded up to a power of two)
+     */
+    explicit spsc_queue(int capacity = 1) : head(0), tail(0) {
+        size_t size = 1;
+        while(size < (size_t)capacity) size *= 2;
+
+        items.resize(size);
+        mask = size - 1;
+    }
+
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+
+    /**
+     * @brief Add an element if there is room (producer only)
+     * @param item Element
+     * @return False if the queue is full
+     */
+    bool try_push(const T& item) {
+        size_t t = tail.load(memory_order_relaxed);
+        if(t - head.load(memory_order_acquire) > mask) return false;
+
+        items[t & mask] = item;
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Take the oldest element if there is one (consumer only)
+     * @param item Result
+     * @return False if the queue is empty
+     */
+    bool try_pop(T& item) {
+        size_t h = head.load(memory_order_relaxed);
+        if(h == tail.load(memory_order_acquire)) return false;
+
+        item = items[h & mask];
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Add an element, waiting while the queue is full (producer only)
+     * @param item Element
+     */
+    void push(const T& item) {
+        while(!try_push(item))
+            this_thread::yield();
+    }
+
+    /**
+     * @brief Take the oldest element, waiting while the queue is empty (consumer only)
+     * @return Element
+     */
+    T pop() {
+        T item;
+        while(!try_pop(item))
+            this_thread::yield();
+        return item;
+    }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef STREAMING_DATA_SET_H
+#define STREAMING_DATA_SET_H
+
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "aligned.h"
+#include "async_reader.h"
+#include "data_set.h"
+
+using namespace std;
+
+/**
+ * @brief Dataset read from disk a window at a time, for IDX files bigger than the memory
+ * @details The image and label files are read sequentially, a chunk of samples at a time,
+ * into a buffer of fixed size (the memory budget). Each sample read goes to a random place of
+ * the buffer (shuffle buffer) and each window given to the network is a chunk taken from it,
+ * so windows mix samples from the whole buffer. Memory use does not depend on the file size.
+ * The files are read with ifstream, or with an async_reader that keeps the next blocks loading
+ * while the network trains (see io_backend)
+ */
+class streaming_data_set {
+private:
+    string data_path, label_path; //*< Paths of the files */
+    ifstream fi_data, fi_labels; //*< Files, positioned at the next sample to read (stream backend) */
+    unique_ptr<async_reader> data_reader, label_reader; //*< Readers of the files (other backends) */
+    int num_samples, num_pixels; //*< Samples in the files and pixels of each one */
+
+    int capacity, chunk; //*< Samples of the buffer and of each read (and window) */
+    int buffered, read; //*< Samples in the buffer and samples read from the files in this epoch */
+    aligned_vector<unsigned char> images, labels; //*< Buffer (capacity samples) */
+
+    mt19937 random; //*< Random numbers of the shuffle */
+    data_set window; //*< View of the last window */
+
+public:
+    /**
+     * @brief Constructor
+     * @param data_path Path to the data file
+     * @param label_path Path to the label file
+     * @param memory_budget Bytes of the sample buffer (at least one sample is kept)
+     * @param chunk_samples Samples of each read and window (0: a quarter of the buffer)
+     * @param seed Seed of the shuffle
+     * @param backend How the files are read (io_uring falls back to pread where not available)
+     * @param direct Bypass the page cache (O_DIRECT, not with the stream backend)
+     */
+    streaming_data_set(const string& data_path, const string& label_path, size_t memory_budget,
+                       int chunk_samples = 0, unsigned seed = 1, io_backend backend = io_backend::stream,
+                       bool direct = false);
+
+    streaming_data_set(const streaming_data_set&) = delete;
+    streaming_data_set& operator=(const streaming_data_set&) = delete;
+
+    /**
+     * @brief Get the number of samples in the files
+     */
+    [[nodiscard]] inline int size() const {return num_samples;};
+
+    /**
+     * @brief Get the number of pixels of each sample
+     */
+    [[nodiscard]] inline int sample_size() const {return num_pixels;};
+
+    /**
+     * @brief Get the number of samples of the buffer
+     */
+    [[nodiscard]] inline int get_capacity() const {return capacity;};
+
+    /**
+     * @brief Get the number of samples of each window
+     */
+    [[nodiscard]] inline int get_chunk() const {return chunk;};
+
+    /**
+     * @brief Get how the files are read
+     */
+    [[nodiscard]] io_backend get_backend() const {return data_reader ? data_reader->get_backend() : io_backend::stream;};
+
+    /**
+     * @brief Start a new epoch from the first sample of the files
+     */
+    void rewind();
+
+    /**
+     * @brief Get the next window of the epoch
+     * @return View of the samples of the window, valid until the next call (the last one of the
+     * epoch until rewind), or null once every sample of the epoch has been given
+     */
+    const data_set* next();
+};
+
+#endif
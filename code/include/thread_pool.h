@@ -0,0 +1,85 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief Fixed group of threads that run the same task together (fork-join)
+ * @details The caller is thread 0, so a pool of n threads starts n - 1 workers. Between
+ * tasks the workers spin for a short while before sleeping, so the small tasks of one
+ * mini-batch are started without waking threads up. Running a task allocates nothing
+ */
+class thread_pool {
+private:
+    vector<thread> workers; //*< Threads 1 to size - 1 */
+    int threads; //*< Number of threads (workers and caller) */
+
+    const void* task; //*< Task being run */
+    void (*call)(const void* task, int index); //*< Runs the task on a thread */
+    atomic<unsigned> generation; //*< Number of tasks started, workers wait for it to change */
+    atomic<int> pending; //*< Workers that have not finished the current task */
+    atomic<bool> busy; //*< Set while a task is running */
+    atomic<bool> stop; //*< Set when the pool is destroyed */
+
+    mutex lock; //*< Protects the sleeping workers and caller */
+    condition_variable wake, done; //*< Signal a new task and the end of one */
+
+public:
+    /**
+     * @brief Constructor
+     * @param threads Number of threads, caller included (0 uses one per hardware thread)
+     */
+    explicit thread_pool(int threads = 0);
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /**
+     * @brief Destructor, waits for the workers to finish
+     */
+    ~thread_pool();
+
+    /**
+     * @brief Get the number of threads (caller included)
+     */
+    [[nodiscard]] int size() const {return threads;};
+
+    /**
+     * @brief Run a task on every thread and wait for all of them
+     * @param task Task, called once with each thread index (0 is the caller)
+     * @details If the pool is already running a task (another caller, or a task of this pool),
+     * the caller runs every index itself instead of waiting
+     */
+    template <class Task>
+    void run(const Task& task) {
+        run(&task, [](const void* t, int index){(*static_cast<const Task*>(t))(index);});
+    }
+
+    /**
+     * @brief Number of hardware threads (at least 1)
+     */
+    static int hardware_threads();
+
+private:
+    /**
+     * @brief Run a type erased task (see run)
+     * @param task Task
+     * @param call Function that runs the task on a thread
+     */
+    void run(const void* task, void (*call)(const void* task, int index));
+
+    /**
+     * @brief Loop of a worker thread
+     * @param index Index of the thread
+     */
+    void worker(int index);
+};
+
+#endif
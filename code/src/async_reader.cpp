@@ -0,0 +1,311 @@
+#include "async_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define NN_PREAD
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define NN_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+//Alignment of the buffers, offsets and sizes of direct I/O
+static const size_t IO_ALIGNMENT = 4096;
+
+const char* io_backend_name(io_backend backend){
+    switch(backend){
+        case io_backend::stream: return "stream";
+        case io_backend::pread: return "pread";
+        case io_backend::io_uring: return "uring";
+    }
+    return "unknown";
+}
+
+bool parse_io_backend(const string& name, io_backend& backend){
+    for(io_backend b : {io_backend::stream, io_backend::pread, io_backend::io_uring})
+        if(name == io_backend_name(b)){
+            backend = b;
+            return true;
+        }
+    return false;
+}
+
+async_reader::async_reader(const string& path, io_backend backend, bool direct, size_t block_size, int depth)
+    : path(path), fd(-1), backend(backend), direct(direct), position(0), memory(nullptr), ring_fd(-1),
+      sq_ring(nullptr), cq_ring(nullptr), sqes(nullptr), sq_ring_size(0), cq_ring_size(0), sqes_size(0) {
+#ifdef NN_PREAD
+    this->block_size = max(IO_ALIGNMENT, (block_size + IO_ALIGNMENT - 1) / IO_ALIGNMENT * IO_ALIGNMENT);
+    depth = max(1, depth);
+
+    //Direct I/O if the file system takes it
+#ifdef O_DIRECT
+    if(direct) fd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+#endif
+    if(fd < 0){
+        this->direct = false;
+        fd = ::open(path.c_str(), O_RDONLY);
+    }
+    if(fd < 0) throw runtime_error("Could not open the file: " + path);
+
+    struct stat info;
+    if(fstat(fd, &info) != 0){
+        ::close(fd);
+        throw runtime_error("Could not open the file: " + path);
+    }
+    file_size = info.st_size;
+
+    memory = static_cast<unsigned char*>(::operator new(this->block_size * depth, align_val_t(IO_ALIGNMENT)));
+    blocks.resize(depth);
+    for(int i = 0; i < depth; i++)
+        blocks[i] = {memory + this->block_size * i, -1, 0, false};
+
+    if(this->backend != io_backend::io_uring || !setup_ring(depth)) this->backend = io_backend::pread;
+    seek(0);
+#else
+    throw runtime_error("Asynchronous reads are not supported on this system");
+#endif
+}
+
+async_reader::~async_reader() {
+#ifdef NN_PREAD
+    bool idle = drain_quietly();
+#ifdef NN_IO_URING
+    if(ring_fd >= 0){
+        munmap(sqes, sqes_size);
+        if(cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        munmap(sq_ring, sq_ring_size);
+        ::close(ring_fd);
+    }
+#endif
+    //If a read may still be writing into the buffers they are leaked rather than freed under it
+    if(idle) ::operator delete(memory, align_val_t(IO_ALIGNMENT));
+    ::close(fd);
+#endif
+}
+
+bool async_reader::io_uring_supported() {
+#ifdef NN_IO_URING
+    io_uring_params params{};
+    int ring = (int)syscall(__NR_io_uring_setup, 1, &params);
+    if(ring < 0) return false;
+    ::close(ring);
+    return (params.features & IORING_FEAT_FAST_POLL) != 0;
+#else
+    return false;
+#endif
+}
+
+bool async_reader::setup_ring(int entries) {
+#ifdef NN_IO_URING
+    io_uring_params params{};
+    ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if(ring_fd < 0) return false;
+
+    //IORING_OP_READ came with the kernels that have fast poll (5.7)
+    if(!(params.features & IORING_FEAT_FAST_POLL)){
+        ::close(ring_fd);
+        ring_fd = -1;
+        return false;
+    }
+
+    //Map the rings
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) sq_ring_size = cq_ring_size = max(sq_ring_size, cq_ring_size);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? sq_ring :
+              mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if(sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED){
+        if(sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if(cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if(sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        ::close(ring_fd);
+        ring_fd = -1;
+        return false;
+    }
+
+    unsigned char* sq = static_cast<unsigned char*>(sq_ring);
+    unsigned char* cq = static_cast<unsigned char*>(cq_ring);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+    return true;
+#else
+    (void)entries;
+    return false;
+#endif
+}
+
+void async_reader::seek(long long offset) {
+    drain();
+    position = offset;
+
+    //Start reading the blocks from the new position on
+    long long first = offset / (long long)block_size;
+    for(block& b : blocks)
+        b.index = -1;
+    for(long long i = first; i < first + (long long)blocks.size(); i++)
+        submit(i);
+}
+
+void async_reader::read(void* destination, size_t bytes) {
+    unsigned char* out = static_cast<unsigned char*>(destination);
+
+#ifdef NN_PREAD
+    //Large buffered reads with pread go straight to the destination, a block would only add a copy
+    if(backend == io_backend::pread && !direct && bytes >= block_size){
+        while(bytes > 0){
+            ssize_t count = pread(fd, out, bytes, position);
+            if(count < 0 && errno == EINTR) continue;
+            if(count <= 0) throw runtime_error("Truncated file: " + path);
+            out += count;
+            bytes -= (size_t)count;
+            position += count;
+        }
+        return;
+    }
+#endif
+
+    while(bytes > 0){
+        long long index = position / (long long)block_size, offset = position % (long long)block_size;
+        const block& b = wait(index);
+        if(offset >= b.size) throw runtime_error("Truncated file: " + path);
+
+        size_t count = (size_t)min<long long>((long long)bytes, b.size - offset);
+        memcpy(out, b.data + offset, count);
+        out += count;
+        bytes -= count;
+        position += (long long)count;
+
+        //A used block is reused for the one depth blocks ahead
+        if(position % (long long)block_size == 0) submit(index + (long long)blocks.size());
+    }
+}
+
+void async_reader::submit(long long index) {
+    block& b = blocks[index % (long long)blocks.size()];
+    if(b.index == index) return;
+
+    b.index = index;
+    b.size = 0;
+    b.pending = index * (long long)block_size < file_size;
+    if(!b.pending || backend != io_backend::io_uring) return;
+
+#ifdef NN_IO_URING
+    //Fill a submission entry and hand it to the kernel
+    unsigned tail = *sq_tail, slot = tail & *sq_mask;
+    io_uring_sqe& sqe = static_cast<io_uring_sqe*>(sqes)[slot];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = fd;
+    sqe.addr = (unsigned long long)b.data;
+    sqe.len = (unsigned)block_size;
+    sqe.off = (unsigned long long)(index * (long long)block_size);
+    sqe.user_data = (unsigned long long)(index % (long long)blocks.size());
+    sq_array[slot] = slot;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if(syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0) < 0)
+        throw runtime_error("Could not read the file: " + path + " (" + strerror(errno) + ")");
+#endif
+}
+
+const async_reader::block& async_reader::wait(long long index) {
+    submit(index);
+    block& b = blocks[index % (long long)blocks.size()];
+
+    if(backend == io_backend::io_uring)
+        while(b.pending)
+            complete();
+    else if(b.pending){
+        read_block(b, 0);
+        b.pending = false;
+    }
+    return b;
+}
+
+void async_reader::drain() {
+    //pread blocks are only read when waited for
+    if(backend != io_backend::io_uring) return;
+
+    for(block& b : blocks)
+        while(b.pending)
+            complete();
+}
+
+bool async_reader::drain_quietly() noexcept {
+#ifdef NN_IO_URING
+    if(backend != io_backend::io_uring) return true;
+
+    for(block& b : blocks)
+        while(b.pending){
+            //Wait for a completion and take it off the queue
+            unsigned head = *cq_head;
+            if(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)){
+                if(syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+                    return false;
+                continue;
+            }
+            blocks[static_cast<const io_uring_cqe*>(cqes)[head & *cq_mask].user_data].pending = false;
+            __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+        }
+#endif
+    return true;
+}
+
+void async_reader::complete() {
+#ifdef NN_IO_URING
+    //Wait for a completion
+    unsigned head = *cq_head;
+    while(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        if(syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+            throw runtime_error("Could not read the file: " + path + " (" + strerror(errno) + ")");
+
+    const io_uring_cqe& cqe = static_cast<const io_uring_cqe*>(cqes)[head & *cq_mask];
+    block& b = blocks[cqe.user_data];
+    int result = cqe.res;
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+
+    if(result < 0 && result != -EAGAIN && result != -EINTR)
+        throw runtime_error("Could not read the file: " + path + " (" + strerror(-result) + ")");
+
+    //Short reads (rare on files) are finished with pread
+    read_block(b, max(0, result));
+    b.pending = false;
+#endif
+}
+
+void async_reader::read_block(block& b, long long done) {
+#ifdef NN_PREAD
+    long long offset = b.index * (long long)block_size;
+    long long wanted = min((long long)block_size, file_size - offset);
+
+    while(done < wanted){
+        //Direct I/O needs aligned offsets and sizes, so read whole aligned pieces again
+        long long start = direct ? done / (long long)IO_ALIGNMENT * (long long)IO_ALIGNMENT : done;
+        ssize_t count = pread(fd, b.data + start, block_size - start, offset + start);
+        if(count < 0 && errno == EINTR) continue;
+        if(count <= 0) throw runtime_error("Could not read the file: " + path);
+        done = start + count;
+    }
+    b.size = done;
+#endif
+}
@@ -0,0 +1,184 @@
+#include "augmentation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "kernels.h"
+
+/**
+ * @brief SplitMix64 random numbers (one 64 bit state, cheap to start from any key)
+ */
+struct splitmix {
+    unsigned long long state; //*< State */
+
+    unsigned long long next() {
+        unsigned long long z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    };
+
+    /**
+     * @brief Random number in [-1, 1)
+     */
+    real uniform() {return (real)((double)(next() >> 40) / (1 << 23) - 1);};
+};
+
+augmenter::augmenter(const augmentation& settings, unsigned seed) : settings(settings), seed(seed) {
+    const int rows = settings.rows, cols = settings.cols;
+    if(rows <= 0 || cols <= 0) throw runtime_error("Invalid size of the augmented images");
+
+    //Gaussian of the elastic distortion, cut at 3 standard deviations
+    radius = settings.elastic_alpha > 0 ? max(0, (int)ceil(3 * settings.elastic_sigma)) : 0;
+    taps.resize(2 * radius + 1);
+    double sum = 0;
+    for(int t = -radius; t <= radius; t++){
+        double sigma = max((double)settings.elastic_sigma, 1e-6);
+        taps[t + radius] = (real)exp(-(double)t * t / (2 * sigma * sigma));
+        sum += taps[t + radius];
+    }
+    for(real& t : taps)
+        t = (real)(t / sum);
+
+    //Coordinates of every pixel relative to the center of the image
+    grid_x.resize(rows * cols);
+    grid_y.resize(rows * cols);
+    for(int y = 0; y < rows; y++)
+        for(int x = 0; x < cols; x++){
+            grid_x[y * cols + x] = (real)(x - (cols - 1) / 2.0);
+            grid_y[y * cols + x] = (real)(y - (rows - 1) / 2.0);
+        }
+}
+
+unsigned long long augmenter::key(unsigned long long round, int position) const {
+    splitmix random{seed};
+    random.state = random.next() ^ round;
+    random.state = random.next() ^ (unsigned long long)position;
+    return random.next();
+}
+
+/**
+ * @brief Add an elastic displacement field to a map
+ * @param random Random numbers of the image
+ * @param taps Normalised Gaussian (2 * radius + 1 taps)
+ * @param alpha Strength of the displacements
+ * @param rows Rows of the image
+ * @param cols Columns of the image
+ * @param field Buffer of the random field (with radius lines of zeros before and after)
+ * @param blurred Buffer of the blurred field
+ * @param map Map of the image, the displacements are added to it
+ */
+static void add_elastic_field(splitmix& random, const vector<real>& taps, real alpha, int rows, int cols,
+                              aligned_vector<real>& field, aligned_vector<real>& blurred, real* map){
+    const kernel_table& k = kernels();
+    const int radius = (int)taps.size() / 2, n = rows * cols;
+    field.resize((size_t)n + 2 * radius * max(rows, cols) + 3);
+    blurred.resize(n);
+
+    //Random displacements in [-1, 1) between radius rows of zeros, 16 bits each are plenty
+    real* values = field.data() + radius * cols;
+    fill(field.begin(), field.end(), 0);
+    for(int i = 0; i < n; i += 4){
+        unsigned long long bits = random.next();
+        for(int j = 0; j < 4; j++, bits >>= 16)
+            values[i + j] = (real)((int)(bits & 0xFFFF) - 32768) / 32768;
+    }
+    fill(values + n, values + n + 3, 0);
+
+    //Blur along the columns: each tap is one axpy of the whole image, shifted by whole rows
+    fill(blurred.begin(), blurred.end(), 0);
+    for(int t = 0; t < (int)taps.size(); t++)
+        k.axpy(taps[t], field.data() + (size_t)t * cols, blurred.data(), n);
+
+    //Transpose between radius columns of zeros and blur along the rows the same way, scaled by alpha
+    fill(field.begin(), field.end(), 0);
+    values = field.data() + radius * rows;
+    for(int y = 0; y < rows; y++)
+        for(int x = 0; x < cols; x++)
+            values[x * rows + y] = blurred[y * cols + x];
+
+    fill(blurred.begin(), blurred.end(), 0);
+    for(int t = 0; t < (int)taps.size(); t++)
+        k.axpy(alpha * taps[t], field.data() + (size_t)t * rows, blurred.data(), n);
+
+    //Transpose back into the map
+    for(int y = 0; y < rows; y++)
+        for(int x = 0; x < cols; x++)
+            map[y * cols + x] += blurred[x * rows + y];
+}
+
+void augmenter::apply(const unsigned char* source, unsigned char* result, unsigned long long key,
+                      augment_workspace& workspace) const {
+    const kernel_table& k = kernels();
+    const int rows = settings.rows, cols = settings.cols, n = rows * cols;
+    splitmix random{key};
+
+    if(settings.max_shift > 0 || settings.max_rotation > 0 || settings.elastic_alpha > 0){
+        workspace.map_x.resize(n);
+        workspace.map_y.resize(n);
+        real* map_x = workspace.map_x.data();
+        real* map_y = workspace.map_y.data();
+
+        //Each pixel reads the position that the shift and rotation bring onto it
+        real dx = settings.max_shift * random.uniform(), dy = settings.max_shift * random.uniform();
+        real angle = settings.max_rotation * random.uniform();
+        real c = cos(angle), s = sin(angle);
+        real cx = (real)((cols - 1) / 2.0), cy = (real)((rows - 1) / 2.0);
+
+        fill(map_x, map_x + n, cx - c * dx - s * dy);
+        k.axpy(c, grid_x.data(), map_x, n);
+        k.axpy(s, grid_y.data(), map_x, n);
+        fill(map_y, map_y + n, cy + s * dx - c * dy);
+        k.axpy(-s, grid_x.data(), map_y, n);
+        k.axpy(c, grid_y.data(), map_y, n);
+
+        //Moved again by the elastic displacements
+        if(settings.elastic_alpha > 0){
+            add_elastic_field(random, taps, settings.elastic_alpha, rows, cols, workspace.field, workspace.blurred, map_x);
+            add_elastic_field(random, taps, settings.elastic_alpha, rows, cols, workspace.field, workspace.blurred, map_y);
+        }
+
+        //Image with a border of zeros (1 pixel before, 2 after), so the resampling needs no bounds checks
+        const int width = cols + 3;
+        workspace.padded.assign((size_t)(rows + 3) * width, 0);
+        for(int y = 0; y < rows; y++)
+            for(int x = 0; x < cols; x++)
+                workspace.padded[(size_t)(y + 1) * width + x + 1] = source[y * cols + x];
+
+        //Bilinear resampling, positions past the border read zeros
+        for(int i = 0; i < n; i++){
+            real sx = min(max(map_x[i], (real)-1), (real)cols) + 1;
+            real sy = min(max(map_y[i], (real)-1), (real)rows) + 1;
+            int x = (int)sx, y = (int)sy;
+            real fx = sx - x, fy = sy - y;
+
+            const real* p = workspace.padded.data() + (size_t)y * width + x;
+            real top = p[0] + fx * (p[1] - p[0]);
+            real bottom = p[width] + fx * (p[width + 1] - p[width]);
+            result[i] = (unsigned char)(top + fy * (bottom - top) + (real)0.5);
+        }
+    }
+    else if(result != source) copy(source, source + n, result);
+
+    //Noise, rounded and saturated to the range of a pixel, 16 random bits per pixel
+    //(locals, or every byte written could alias the random state)
+    if(settings.noise > 0){
+        splitmix noise_random = random;
+        const real noise = settings.noise / 32768;
+        unsigned long long bits = 0;
+        for(int i = 0; i < n; i++, bits >>= 16){
+            if(i % 4 == 0) bits = noise_random.next();
+            int value = (int)(result[i] + noise * (real)((int)(bits & 0xFFFF) - 32768) + (real)0.5);
+            result[i] = (unsigned char)min(value & ~(value >> 31), 255); //No branches, the noise is random
+        }
+    }
+}
+
+void augmenter::apply(byte_matrix& batch, unsigned long long round, int first, augment_workspace& workspace) const {
+    const int n = settings.rows * settings.cols;
+    if(batch.get_cols() != n) throw runtime_error("The augmented images do not match the size of the samples");
+
+    for(int r = 0; r < batch.get_rows(); r++)
+        apply(batch.row(r).data(), batch.row(r).data(), key(round, first + r), workspace);
+}
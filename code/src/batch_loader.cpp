@@ -0,0 +1,132 @@
+#include "batch_loader.h"
+
+#include <algorithm>
+
+batch_loader::batch_loader(int num_outputs, int batch_size, int slices, int chunk, double sparse_threshold,
+                           int depth, int threads, const augmenter* augment)
+    : dataset(nullptr), num_outputs(num_outputs), batch_size(batch_size), slices(slices), chunk(chunk),
+      sparse_threshold(sparse_threshold), order(nullptr), augment(augment), round(0), batches(0), current(0),
+      current_slot(0), pass(0), cancel(false), stop(false) {
+    depth = max(1, depth);
+    threads = max(1, threads);
+    for(int t = 0; t < threads; t++){
+        loaders.push_back(make_unique<loader>(depth));
+        for(int s = 0; s < depth; s++)
+            loaders[t]->free.push(s);
+    }
+
+    for(int t = 0; t < threads; t++)
+        loaders[t]->worker = thread(&batch_loader::load, this, t);
+}
+
+batch_loader::~batch_loader() {
+    stop = true;
+    for(unique_ptr<loader>& l : loaders)
+        l->worker.join();
+}
+
+void batch_loader::restart(const data_set& new_dataset, const int* new_order, unsigned long long new_round) {
+    //Wait for every thread to leave the previous pass
+    const unsigned previous = pass.load(memory_order_relaxed);
+    cancel = true;
+    for(unique_ptr<loader>& l : loaders)
+        while(l->finished.load(memory_order_acquire) != previous)
+            this_thread::yield();
+
+    //Batches loaded and not taken go back to their loaders
+    for(unique_ptr<loader>& l : loaders){
+        int slot;
+        while(l->ready.try_pop(slot))
+            l->free.push(slot);
+    }
+
+    dataset = &new_dataset;
+    order = new_order;
+    round = new_round;
+    batches = (new_dataset.size() + batch_size - 1) / batch_size;
+    current = 0;
+    cancel = false;
+    pass.store(previous + 1, memory_order_release);
+}
+
+void batch_loader::slice(int start, int size, int index, int slices, int chunk, int& first, int& last) {
+    if(chunk > 0){
+        first = min(start + index * chunk, start + size);
+        last = min(first + chunk, start + size);
+    }
+    else{
+        first = start + size * index / slices;
+        last = start + size * (index + 1) / slices;
+    }
+}
+
+const prepared_batch& batch_loader::next() {
+    loader& l = *loaders[current % loaders.size()];
+    current_slot = l.ready.pop();
+    return l.slots[current_slot];
+}
+
+void batch_loader::release() {
+    loaders[current % loaders.size()]->free.push(current_slot);
+    current++;
+}
+
+void batch_loader::load(int index) {
+    loader& l = *loaders[index];
+
+    for(unsigned seen = 0;;){
+        //Wait for the next pass
+        unsigned current_pass;
+        while((current_pass = pass.load(memory_order_acquire)) == seen){
+            if(stop.load(memory_order_relaxed)) return;
+            this_thread::yield();
+        }
+        seen = current_pass;
+
+        for(int batch = index; batch < batches && !cancel.load(memory_order_relaxed); batch += (int)loaders.size()){
+            //Wait for a used slot, unless a restart drops the rest of the pass
+            int slot;
+            bool popped;
+            while(!(popped = l.free.try_pop(slot)) && !cancel.load(memory_order_relaxed)){
+                if(stop.load(memory_order_relaxed)) return;
+                this_thread::yield();
+            }
+            if(!popped) break;
+
+            prepare(batch, l.slots[slot]);
+            l.ready.push(slot);
+        }
+        l.finished.store(seen, memory_order_release);
+    }
+}
+
+void batch_loader::prepare(int batch, prepared_batch& result) const {
+    result.start = batch * batch_size;
+    result.size = min(batch_size, dataset->size() - result.start);
+    result.slices.resize(slices);
+
+    for(int s = 0; s < slices; s++){
+        prepared_slice& slice = result.slices[s];
+        int last;
+        batch_loader::slice(result.start, result.size, s, slices, chunk, slice.first, last);
+        slice.size = last - slice.first;
+        if(slice.size == 0) continue;
+
+        //Shuffled slices are gathered from wherever their samples are
+        const int* indices = order != nullptr ? order + slice.first : nullptr;
+        if(indices != nullptr) dataset->load_one_hot(indices, slice.size, num_outputs, slice.expected);
+        else dataset->load_one_hot(slice.first, slice.size, num_outputs, slice.expected);
+
+        //Sparse slices are read straight from the sparse copy (unless transformed), the rest is gathered
+        slice.sparse = augment == nullptr && dataset->has_sparse();
+        if(slice.sparse)
+            slice.sparse_inputs = indices != nullptr ? dataset->sparse_batch(indices, slice.size, slice.gathered)
+                                                     : dataset->sparse_batch(slice.first, slice.size);
+        slice.sparse = slice.sparse && slice.sparse_inputs.density() <= sparse_threshold;
+        if(slice.sparse) continue;
+
+        if(indices != nullptr) dataset->load_batch(indices, slice.size, slice.inputs);
+        else dataset->load_batch(slice.first, slice.size, slice.inputs);
+        if(augment != nullptr) augment->apply(slice.inputs, round, slice.first, slice.workspace);
+    }
+}
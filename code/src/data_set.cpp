@@ -3,20 +3,168 @@
 //
 
 #include "data_set.h"
+#include "dataset_cache.h"
+#include "kernels.h"
 
-data_set::data_set(const string& data_path, const string& label_path) {
-    open(data_path, label_path);
+#if defined(__unix__) || defined(__APPLE__)
+#define NN_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Map a whole file in memory (read only)
+ * @param path Path to the file
+ * @param bytes Expected size of the file (at least)
+ * @param mapped Size of the file mapped (output, optional)
+ * @return First byte of the file, unmapped when the last copy is destroyed
+ */
+static shared_ptr<const unsigned char> map_file(const string& path, size_t bytes, size_t* mapped = nullptr){
+#ifdef NN_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) throw runtime_error("Could not open the file: " + path);
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < bytes){
+        ::close(fd);
+        throw runtime_error("Truncated MNIST file: " + path);
+    }
+
+    size_t size = info.st_size;
+    void* memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(memory == MAP_FAILED) throw runtime_error("Could not map the file: " + path);
+    if(mapped) *mapped = size;
+
+    return shared_ptr<const unsigned char>(static_cast<const unsigned char*>(memory),
+                                           [size](const unsigned char* p){munmap((void*)p, size);});
+#else
+    return nullptr;
+#endif
 }
 
-void data_set::open(const string& data_path, const string& label_path){
+data_set::data_set(const string& data_path, const string& label_path, dataset_storage storage)
+    : storage(storage), num_samples(0), num_pixels(0), sample_stride(0), pixel_scale(1), images(nullptr),
+      image_labels(nullptr), mask_stride(0) {
+    open(data_path, label_path, storage);
+}
+
+data_set::data_set(const unsigned char* images, const unsigned char* labels, int samples, int pixels)
+    : storage(dataset_storage::borrowed), num_samples(samples), num_pixels(pixels), sample_stride(pixels),
+      pixel_scale(1), images(images), image_labels(labels), mask_stride(0) {}
+
+void data_set::open(const string& data_path, const string& label_path, dataset_storage storage){
+    close();
+
+#ifdef NN_MMAP
+    //MAPPING THE CACHE: nothing is parsed, the IDX files are only looked at to tell if the cache is stale
+    if(storage == dataset_storage::cached){
+        string cache_path = dataset_cache::default_path(data_path);
+        if(!dataset_cache::is_valid(cache_path, data_path, label_path))
+            dataset_cache::build(data_path, label_path, cache_path);
+
+        //The file may have changed since is_valid, so every part is checked to be inside the mapping
+        size_t size;
+        shared_ptr<const unsigned char> cache = map_file(cache_path, sizeof(dataset_cache_header), &size);
+        const dataset_cache_header& header = *reinterpret_cast<const dataset_cache_header*>(cache.get());
+        if(header.shards > (size - sizeof(header)) / sizeof(uint64_t) || !dataset_cache::header_valid(header) ||
+           header.labels_offset + header.samples > size ||
+           header.images_offset + (uint64_t)header.samples * header.stride > size)
+            throw runtime_error("Invalid dataset cache: " + cache_path);
+
+        num_samples = (int)header.samples;
+        num_pixels = (int)(header.rows * header.cols);
+        sample_stride = (int)header.stride;
+        pixel_scale = header.scale;
+        mapped_images = mapped_labels = cache;
+        images = cache.get() + header.images_offset;
+        image_labels = cache.get() + header.labels_offset;
 
+        this->storage = storage;
+        return;
+    }
+#endif
+
+    ifstream fi_data, fi_labels;
+    int num_images, num_rows, num_cols;
+    read_headers(data_path, label_path, fi_data, fi_labels, num_images, num_rows, num_cols);
+    int num_labels = num_images;
+    num_samples = num_images;
+    num_pixels = num_rows * num_cols;
+    sample_stride = num_pixels;
+
+#ifdef NN_MMAP
+    //MAPPING THE FILES: samples are views into the page cache, nothing is read or copied
+    if(storage == dataset_storage::mapped){
+        const size_t data_header = 4 * sizeof(int), label_header = 2 * sizeof(int);
+
+        mapped_images = map_file(data_path, data_header + (size_t)num_images * num_pixels);
+        mapped_labels = map_file(label_path, label_header + (size_t)num_labels);
+        images = mapped_images.get() + data_header;
+        image_labels = mapped_labels.get() + label_header;
+
+        this->storage = storage;
+        return;
+    }
+#endif
+
+    //READING LABELS
+    labels.resize(num_labels);
+    fi_labels.read((char*)labels.data(), num_labels);
+
+    //COMPRESSING IMAGES: each sample is read into one buffer and only its non zero pixels are kept
+    if(storage == dataset_storage::compressed){
+        vector<unsigned char> pixels(num_pixels);
+        mask_stride = (num_pixels + 63) / 64 * 8;
+        packed_masks.assign((size_t)num_images * mask_stride, 0);
+        packed_offsets.resize(num_images + 1);
+        packed_offsets[0] = 0;
+
+        for(int j = 0; j < num_images; j++){
+            fi_data.read((char*)pixels.data(), num_pixels);
+            unsigned char* mask = packed_masks.data() + (size_t)j * mask_stride;
+            for(int i = 0; i < num_pixels; i++)
+                if(pixels[i] != 0){
+                    mask[i >> 3] |= (unsigned char)(1 << (i & 7));
+                    packed_values.push_back(pixels[i]);
+                }
+            packed_offsets[j + 1] = packed_values.size();
+        }
+        if(!fi_data) throw runtime_error("Truncated MNIST file: " + data_path);
+
+        //The decoder can read a little past the last value
+        packed_values.resize(packed_values.size() + 64, 0);
+        packed_values.shrink_to_fit();
+
+        this->storage = storage;
+        return;
+    }
+    this->storage = dataset_storage::owning;
+
+    //READING IMAGES
+    data.resize(num_images);
+    for(int j = 0; j < num_images; j++) {
+        data[j].resize(num_cols * num_rows);
+        fi_data.read((char*)data[j].data(), num_rows*num_cols );
+    }
+
+    fi_data.close();
+    fi_labels.close();
+}
+
+
+void data_set::read_headers(const string& data_path, const string& label_path, ifstream& fi_data,
+                            ifstream& fi_labels, int& num_images, int& num_rows, int& num_cols){
     //OPENING AND READING MAGIC NUMBER AND DESCRIPTORS OF THE DATA
-    ifstream fi_data(data_path,ios::binary);
+    fi_data.open(data_path,ios::binary);
 
     if (!fi_data.is_open()) {
         throw runtime_error("Could not open the data file: " + data_path);
     }
-    int data_magic = 0, num_images = 0, num_rows = 0, num_cols = 0;
+    int data_magic = 0;
+    num_images = num_rows = num_cols = 0;
 
     fi_data.read((char *) &data_magic, sizeof(int));
 
@@ -34,7 +182,7 @@ void data_set::open(const string& data_path, const string& label_path){
     num_cols = reverseInt(num_cols);
 
     //OPENING AND READING MAGIC NUMBER AND DESCRIPTORS OF LABELS
-    ifstream fi_labels(label_path, ios::binary);
+    fi_labels.open(label_path, ios::binary);
     int label_magic = 0, num_labels = 0;
 
     fi_labels.read((char *) &label_magic, sizeof(int));
@@ -50,19 +198,124 @@ void data_set::open(const string& data_path, const string& label_path){
 
     std::cout << "Dataset format: " << num_images << " images of size " << num_rows << "x" << num_cols << std::endl;
     std::cout << "Dataset labels: " << num_labels << std::endl;
+}
 
-    //READING IMAGES
-    data.resize(num_images);
-    for(int j = 0; j < num_images; j++) {
-        data[j].resize(num_cols * num_rows);
-        fi_data.read((char*)data[j].data(), num_rows*num_cols );
+
+void data_set::load_batch(int start_pos, int batch_size, matrix& batch, real scale) const {
+    int size = num_pixels;
+
+    if(batch.get_rows() != batch_size || batch.get_cols() != size)
+        batch = matrix(batch_size, size);
+
+    //Convert each sample to real. Compressed samples are decoded into the first bytes of their
+    //own row, then widened from the last pixel back, so no pixel is overwritten before it is read
+    for(int i = 0; i < batch_size; i++){
+        real* row = batch.row(i).data();
+        const unsigned char* pixels = reinterpret_cast<const unsigned char*>(row);
+        if(storage == dataset_storage::compressed) copy_sample(start_pos + i, reinterpret_cast<unsigned char*>(row));
+        else pixels = sample(start_pos + i).data();
+        for(int j = size - 1; j >= 0; j--)
+            row[j] = (real)((accumulator)pixels[j] * scale);
     }
+}
 
-    //READING LABELS
-    labels.resize(num_labels);
-    fi_labels.read((char*)labels.data(), num_labels);
+void data_set::load_batch(int start_pos, int batch_size, byte_matrix& batch) const {
+    int size = num_pixels;
 
-    fi_data.close();
-    fi_labels.close();
+    if(batch.get_rows() != batch_size || batch.get_cols() != size)
+        batch = byte_matrix(batch_size, size);
+
+    for(int i = 0; i < batch_size; i++)
+        copy_sample(start_pos + i, batch.row(i).data());
+}
+
+void data_set::load_batch(const int* indices, int batch_size, byte_matrix& batch) const {
+    int size = num_pixels;
+
+    if(batch.get_rows() != batch_size || batch.get_cols() != size)
+        batch = byte_matrix(batch_size, size);
+
+    for(int i = 0; i < batch_size; i++)
+        copy_sample(indices[i], batch.row(i).data());
 }
 
+void data_set::copy_sample(int index, unsigned char* destination) const {
+    //Compressed samples are decoded straight into the destination
+    if(storage == dataset_storage::compressed){
+        kernels().expand_bytes(packed_masks.data() + (size_t)index * mask_stride,
+                               packed_values.data() + packed_offsets[index], destination, num_pixels);
+        return;
+    }
+
+    array_view<const unsigned char> pixels = sample(index);
+    copy(pixels.begin(), pixels.end(), destination);
+}
+
+size_t data_set::memory_size() const {
+    size_t bytes = labels.capacity() + packed_masks.capacity() + packed_values.capacity()
+                   + packed_offsets.capacity() * sizeof(size_t) + data.capacity() * sizeof(vector<unsigned char>);
+    for(const vector<unsigned char>& d : data)
+        bytes += d.capacity();
+    return bytes;
+}
+
+void data_set::load_one_hot(int start_pos, int batch_size, int classes, matrix& expected) const {
+    if(expected.get_rows() != batch_size || expected.get_cols() != classes) expected = matrix(batch_size, classes);
+    else expected.fill(0);
+
+    for(int i = 0; i < batch_size; i++)
+        expected(i, label(start_pos + i)) = 1;
+}
+
+void data_set::load_one_hot(const int* indices, int batch_size, int classes, matrix& expected) const {
+    if(expected.get_rows() != batch_size || expected.get_cols() != classes) expected = matrix(batch_size, classes);
+    else expected.fill(0);
+
+    for(int i = 0; i < batch_size; i++)
+        expected(i, label(indices[i])) = 1;
+}
+
+void data_set::build_sparse(){
+    sparse_offsets.assign(1, 0);
+    sparse_indices.clear();
+    sparse_values.clear();
+
+    //Keep only the non zero pixels of every sample
+    vector<unsigned char> pixels(num_pixels);
+    for(int s = 0; s < num_samples; s++){
+        copy_sample(s, pixels.data());
+        for(int i = 0; i < num_pixels; i++)
+            if(pixels[i] != 0){
+                sparse_indices.push_back(i);
+                sparse_values.push_back(pixels[i]);
+            }
+        sparse_offsets.push_back((int)sparse_indices.size());
+    }
+}
+
+sparse_matrix data_set::sparse_batch(int start_pos, int batch_size) const {
+    return {sparse_offsets.data() + start_pos, sparse_indices.data(), sparse_values.data(), batch_size, num_pixels};
+}
+
+sparse_matrix data_set::sparse_batch(const int* indices, int batch_size, sparse_buffer& buffer) const {
+    //Size the buffer first, it only grows
+    int non_zeros = 0;
+    for(int i = 0; i < batch_size; i++)
+        non_zeros += sparse_offsets[indices[i] + 1] - sparse_offsets[indices[i]];
+    buffer.offsets.resize(batch_size + 1);
+    if((int)buffer.indices.size() < non_zeros){
+        buffer.indices.resize(non_zeros);
+        buffer.values.resize(non_zeros);
+    }
+
+    //Copy the non zero pixels of each sample
+    buffer.offsets[0] = 0;
+    for(int i = 0; i < batch_size; i++){
+        int first = sparse_offsets[indices[i]], last = sparse_offsets[indices[i] + 1];
+        copy(sparse_indices.begin() + first, sparse_indices.begin() + last, buffer.indices.begin() + buffer.offsets[i]);
+        copy(sparse_values.begin() + first, sparse_values.begin() + last, buffer.values.begin() + buffer.offsets[i]);
+        buffer.offsets[i + 1] = buffer.offsets[i] + last - first;
+    }
+
+    return {buffer.offsets.data(), buffer.indices.data(), buffer.values.data(), batch_size, num_pixels};
+}
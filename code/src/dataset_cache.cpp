@@ -0,0 +1,170 @@
+#include "dataset_cache.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include "data_set.h"
+
+/**
+ * @brief Round a position up to a whole number of cache lines
+ */
+static uint64_t align_up(uint64_t position){
+    return (position + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+/**
+ * @brief Modification time of a file (0 if it can not be read)
+ */
+static int64_t modification_time(const string& path){
+    error_code error;
+    auto time = filesystem::last_write_time(path, error);
+    return error ? 0 : (int64_t)time.time_since_epoch().count();
+}
+
+/**
+ * @brief Size of a file (0 if it can not be read)
+ */
+static uint64_t size_of(const string& path){
+    error_code error;
+    auto size = filesystem::file_size(path, error);
+    return error ? 0 : (uint64_t)size;
+}
+
+uint64_t dataset_cache::checksum(const void* data, size_t size, uint64_t checksum){
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i < size; i++)
+        checksum = (checksum ^ bytes[i]) * 1099511628211ull;
+    return checksum;
+}
+
+bool dataset_cache::header_valid(const dataset_cache_header& header){
+    if(memcmp(header.magic, "NNCACHE", 8) != 0 || header.version != VERSION) return false;
+
+    uint64_t sum = checksum(&header, offsetof(dataset_cache_header, checksum));
+    sum = checksum(&header + 1, (size_t)header.shards * sizeof(uint64_t), sum);
+    return sum == header.checksum;
+}
+
+void dataset_cache::build(const string& data_path, const string& label_path, const string& cache_path,
+                          int shard_samples){
+    ifstream fi_data, fi_labels;
+    int num_images, num_rows, num_cols;
+    data_set::read_headers(data_path, label_path, fi_data, fi_labels, num_images, num_rows, num_cols);
+
+    const int pixels = num_rows * num_cols;
+    shard_samples = max(1, shard_samples);
+
+    dataset_cache_header header{};
+    memcpy(header.magic, "NNCACHE", 8);
+    header.version = VERSION;
+    header.samples = num_images;
+    header.rows = num_rows;
+    header.cols = num_cols;
+    header.stride = padded_size<unsigned char>(pixels);
+    header.shard_samples = shard_samples;
+    header.shards = (num_images + shard_samples - 1) / shard_samples;
+    header.scale = 1.0f / 255;
+    header.image_size = size_of(data_path);
+    header.label_size = size_of(label_path);
+    header.image_time = modification_time(data_path);
+    header.label_time = modification_time(label_path);
+    header.labels_offset = align_up(sizeof(header) + (uint64_t)header.shards * sizeof(uint64_t));
+    header.images_offset = align_up(header.labels_offset + num_images);
+
+    vector<unsigned char> labels(num_images);
+    fi_labels.read((char*)labels.data(), num_images);
+    if(!fi_labels) throw runtime_error("Truncated MNIST file: " + label_path);
+    header.labels_checksum = checksum(labels.data(), labels.size());
+
+    //Written next to the cache and renamed at the end, so a cache is never seen half written
+    string temporary = cache_path + ".tmp";
+    ofstream out(temporary, ios::binary | ios::trunc);
+    if(!out.is_open()) throw runtime_error("Could not create the cache file: " + temporary);
+
+    vector<char> padding(header.images_offset, 0);
+    out.write(padding.data(), (streamsize)header.labels_offset);
+    out.write((const char*)labels.data(), num_images);
+    out.write(padding.data(), (streamsize)(header.images_offset - header.labels_offset - num_images));
+
+    //Samples, a shard at a time, each one padded to the stride
+    vector<uint64_t> shard_checksums(header.shards);
+    vector<unsigned char> shard((size_t)shard_samples * header.stride);
+    for(uint32_t s = 0; s < header.shards; s++){
+        int count = min(shard_samples, num_images - (int)(s * shard_samples));
+        fill(shard.begin(), shard.end(), 0);
+        for(int i = 0; i < count; i++)
+            fi_data.read((char*)shard.data() + (size_t)i * header.stride, pixels);
+        if(!fi_data) throw runtime_error("Truncated MNIST file: " + data_path);
+
+        shard_checksums[s] = checksum(shard.data(), (size_t)count * header.stride);
+        out.write((const char*)shard.data(), (streamsize)count * header.stride);
+    }
+
+    //Header and shard checksums, once every checksum is known
+    header.checksum = checksum(&header, offsetof(dataset_cache_header, checksum));
+    header.checksum = checksum(shard_checksums.data(), shard_checksums.size() * sizeof(uint64_t), header.checksum);
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)shard_checksums.data(), (streamsize)(shard_checksums.size() * sizeof(uint64_t)));
+
+    out.close();
+    if(!out) throw runtime_error("Could not write the cache file: " + temporary);
+    filesystem::rename(temporary, cache_path);
+}
+
+/**
+ * @brief Read the header of a cache followed by its shard checksums
+ * @param file_size Size of the cache file, bounds the number of shards of a damaged header
+ * @return False if the file can not be read
+ */
+static bool read_header(ifstream& in, uint64_t file_size, vector<dataset_cache_header>& buffer){
+    buffer.resize(1);
+    if(!in.read((char*)buffer.data(), sizeof(dataset_cache_header))) return false;
+    if(memcmp(buffer[0].magic, "NNCACHE", 8) != 0) return false;
+    if(buffer[0].shards > (file_size - sizeof(dataset_cache_header)) / sizeof(uint64_t)) return false;
+
+    //The shard checksums right after the header, in the same buffer
+    size_t table = (size_t)buffer[0].shards * sizeof(uint64_t);
+    buffer.resize(1 + (table + sizeof(dataset_cache_header) - 1) / sizeof(dataset_cache_header));
+    return (bool)in.read((char*)(buffer.data() + 1), (streamsize)table);
+}
+
+bool dataset_cache::is_valid(const string& cache_path, const string& data_path, const string& label_path){
+    ifstream in(cache_path, ios::binary);
+    vector<dataset_cache_header> buffer;
+    if(!in.is_open() || !read_header(in, size_of(cache_path), buffer) || !header_valid(buffer[0])) return false;
+
+    const dataset_cache_header& header = buffer[0];
+    return header.image_size == size_of(data_path) && header.label_size == size_of(label_path) &&
+           header.image_time == modification_time(data_path) && header.label_time == modification_time(label_path) &&
+           size_of(cache_path) >= header.images_offset + (uint64_t)header.samples * header.stride;
+}
+
+bool dataset_cache::verify(const string& cache_path){
+    ifstream in(cache_path, ios::binary);
+    vector<dataset_cache_header> buffer;
+    if(!in.is_open() || !read_header(in, size_of(cache_path), buffer) || !header_valid(buffer[0])) return false;
+
+    const dataset_cache_header header = buffer[0];
+    const uint64_t* shard_checksums = reinterpret_cast<const uint64_t*>(buffer.data() + 1);
+
+    vector<unsigned char> bytes(header.samples);
+    in.seekg((streamoff)header.labels_offset);
+    if(!in.read((char*)bytes.data(), header.samples) || checksum(bytes.data(), bytes.size()) != header.labels_checksum)
+        return false;
+
+    in.seekg((streamoff)header.images_offset);
+    for(uint32_t s = 0; s < header.shards; s++){
+        uint32_t count = min(header.shard_samples, header.samples - s * header.shard_samples);
+        bytes.resize((size_t)count * header.stride);
+        if(!in.read((char*)bytes.data(), (streamsize)bytes.size()) ||
+           checksum(bytes.data(), bytes.size()) != shard_checksums[s])
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+#include "epoch_sampler.h"
+
+#include <algorithm>
+
+epoch_sampler::epoch_sampler(int block_samples, int window_blocks, unsigned seed)
+    : block_samples(max(1, block_samples)), window_blocks(max(1, window_blocks)), seed(seed) {}
+
+void epoch_sampler::reserve(int samples) {
+    if((int)order.size() < samples){
+        order.resize(samples);
+        blocks.resize((samples + block_samples - 1) / block_samples);
+    }
+}
+
+const int* epoch_sampler::shuffle(int samples, unsigned epoch, unsigned window) {
+    reserve(samples);
+    const int num_blocks = (samples + block_samples - 1) / block_samples;
+
+    //Every epoch and window starts from its own seed, so any of them can be replayed alone
+    random.seed(seed ^ (epoch * 0x9E3779B9u) ^ (window * 0x85EBCA6Bu));
+
+    //Shuffle the blocks (Fisher-Yates)
+    for(int b = 0; b < num_blocks; b++)
+        blocks[b] = b;
+    for(int b = num_blocks - 1; b > 0; b--)
+        swap(blocks[b], blocks[below(b + 1)]);
+
+    //Lay the samples of the blocks out in their new order
+    int position = 0;
+    for(int b = 0; b < num_blocks; b++){
+        int first = blocks[b] * block_samples, last = min(first + block_samples, samples);
+        for(int s = first; s < last; s++)
+            order[position++] = s;
+    }
+
+    //Shuffle the samples within each window
+    const int window_samples = block_samples * window_blocks;
+    for(int first = 0; first < samples; first += window_samples){
+        int size = min(window_samples, samples - first);
+        for(int i = size - 1; i > 0; i--)
+            swap(order[first + i], order[first + below(i + 1)]);
+    }
+
+    return order.data();
+}
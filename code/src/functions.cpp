@@ -2,21 +2,21 @@
 #include "functions.h"
 
 
-double ReLu(double input){
-    return input >= 0 ? input : input * 0.01;
+real ReLu(real input){
+    return input >= 0 ? input : input * (real)0.01;
 }
-double d_ReLu(double input){
+real d_ReLu(real input){
     return input >= 0 ? 1 : 0;
 }
 
 
-double sig(double input){
-    double aux = 1/(1+exp(-input));
+real sig(real input){
+    real aux = 1/(1+std::exp(-input));
     if(aux > MAX_SIG) return MAX_SIG;
     else if(aux < MIN_SIG) return MIN_SIG;
     return aux;
 }
-double d_sig(double output){
+real d_sig(real output){
     return output * (1 - output);
 }
 
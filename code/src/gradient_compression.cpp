@@ -0,0 +1,236 @@
+#include "gradient_compression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+//Gradients sharing a scale in int8
+static const int INT8_BLOCK = 256;
+
+const char* compression_name(compression method){
+    switch(method){
+        case compression::fp16: return "fp16";
+        case compression::bf16: return "bf16";
+        case compression::top_k: return "topk";
+        case compression::int8: return "int8";
+        default: return "none";
+    }
+}
+
+bool parse_compression(const string& name, compression& method){
+    for(compression c : {compression::none, compression::fp16, compression::bf16, compression::top_k, compression::int8})
+        if(name == compression_name(c)){
+            method = c;
+            return true;
+        }
+    return false;
+}
+
+/**
+ * @brief Round a float to the nearest half (ties to even), saturated to the largest finite half
+ */
+static uint16_t to_half(float value){
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t mantissa = bits & 0x7fffff;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+
+    //Not a number
+    if(((bits >> 23) & 0xff) == 0xff && mantissa != 0) return sign | 0x7e00;
+
+    //Too big (infinity included)
+    if(exponent >= 31) return sign | 0x7bff;
+
+    //Subnormal half (or 0)
+    if(exponent <= 0){
+        if(exponent < -10) return sign;
+
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift, rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if(rest > halfway || (rest == halfway && (half & 1))) half++;
+        return sign | half;
+    }
+
+    uint32_t half = sign | (exponent << 10) | (mantissa >> 13), rest = mantissa & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+
+    //Rounding up may overflow to infinity
+    if((half & 0x7fff) >= 0x7c00) half = sign | 0x7bff;
+    return half;
+}
+
+/**
+ * @brief Value of a half
+ */
+static float from_half(uint16_t half){
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f, mantissa = half & 0x3ff;
+
+    if(exponent == 0){
+        float value = ldexp((float)mantissa, -24);
+        return sign ? -value : value;
+    }
+
+    uint32_t bits = exponent == 31 ? sign | 0x7f800000 | (mantissa << 13)
+                                   : sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Round a float to the nearest bfloat16 (ties to even)
+ */
+static uint16_t to_bfloat(float value){
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    if(isnan(value)) return (uint16_t)((bits >> 16) | 0x40);
+    return (uint16_t)((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+}
+
+/**
+ * @brief Value of a bfloat16
+ */
+static float from_bfloat(uint16_t bfloat){
+    uint32_t bits = (uint32_t)bfloat << 16;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+gradient_compressor::gradient_compressor(compression method, double top_k_ratio, unsigned seed)
+    : method(method), top_k_ratio(top_k_ratio), random(seed) {}
+
+void gradient_compressor::compress(array_view<const accumulator> gradients, vector<unsigned char>& message){
+    const int n = gradients.size();
+
+    switch(method){
+        case compression::fp16:
+        case compression::bf16: {
+            message.resize((size_t)n * sizeof(uint16_t));
+            uint16_t* out = reinterpret_cast<uint16_t*>(message.data());
+            for(int i = 0; i < n; i++)
+                out[i] = method == compression::fp16 ? to_half((float)gradients[i]) : to_bfloat((float)gradients[i]);
+            break;
+        }
+
+        case compression::top_k: {
+            //Error feedback: what was not sent before is added to the new gradients
+            if(residual.size() != (size_t)n){
+                residual.assign(n, 0);
+                order.resize(n);
+            }
+            for(int i = 0; i < n; i++){
+                residual[i] += gradients[i];
+                order[i] = i;
+            }
+
+            //The k largest magnitudes, sorted by index
+            uint32_t k = (uint32_t)min<double>(n, max(1.0, ceil(top_k_ratio * n)));
+            nth_element(order.begin(), order.begin() + (k - 1), order.end(),
+                        [&](uint32_t a, uint32_t b){return fabs(residual[a]) > fabs(residual[b]);});
+            sort(order.begin(), order.begin() + k);
+
+            //Number of gradients sent, then index and value of each one
+            message.resize(sizeof(uint32_t) + (size_t)k * (sizeof(uint32_t) + sizeof(float)));
+            unsigned char* out = message.data();
+            memcpy(out, &k, sizeof(k));
+            out += sizeof(k);
+            for(uint32_t j = 0; j < k; j++){
+                uint32_t index = order[j];
+                float value = (float)residual[index];
+                memcpy(out, &index, sizeof(index));
+                memcpy(out + sizeof(index), &value, sizeof(value));
+                out += sizeof(index) + sizeof(value);
+
+                //Only the rounding of the sent value stays behind
+                residual[index] -= value;
+            }
+            break;
+        }
+
+        case compression::int8: {
+            //Each block: its scale, then one byte per gradient
+            int blocks = (n + INT8_BLOCK - 1) / INT8_BLOCK;
+            message.resize((size_t)blocks * sizeof(float) + n);
+            unsigned char* out = message.data();
+            uniform_real_distribution<float> uniform(0, 1);
+
+            for(int first = 0; first < n; first += INT8_BLOCK){
+                int last = min(n, first + INT8_BLOCK);
+
+                float largest = 0;
+                for(int i = first; i < last; i++)
+                    largest = max(largest, (float)fabs(gradients[i]));
+                float scale = largest / 127;
+                memcpy(out, &scale, sizeof(scale));
+                out += sizeof(scale);
+
+                //Round down or up with the probability that keeps the expected value
+                for(int i = first; i < last; i++){
+                    float q = scale > 0 ? floor((float)gradients[i] / scale + uniform(random)) : 0;
+                    *out++ = (unsigned char)(int8_t)max(-127.0f, min(127.0f, q));
+                }
+            }
+            break;
+        }
+
+        default:
+            message.resize((size_t)n * sizeof(accumulator));
+            memcpy(message.data(), gradients.data(), message.size());
+    }
+}
+
+void gradient_compressor::decompress(const vector<unsigned char>& message, array_view<accumulator> gradients) const{
+    const int n = gradients.size();
+
+    switch(method){
+        case compression::fp16:
+        case compression::bf16: {
+            const uint16_t* in = reinterpret_cast<const uint16_t*>(message.data());
+            for(int i = 0; i < n; i++)
+                gradients[i] = method == compression::fp16 ? from_half(in[i]) : from_bfloat(in[i]);
+            break;
+        }
+
+        case compression::top_k: {
+            fill(gradients.begin(), gradients.end(), 0);
+
+            const unsigned char* in = message.data();
+            uint32_t k;
+            memcpy(&k, in, sizeof(k));
+            in += sizeof(k);
+            for(uint32_t j = 0; j < k; j++){
+                uint32_t index;
+                float value;
+                memcpy(&index, in, sizeof(index));
+                memcpy(&value, in + sizeof(index), sizeof(value));
+                in += sizeof(index) + sizeof(value);
+                gradients[index] = value;
+            }
+            break;
+        }
+
+        case compression::int8: {
+            const unsigned char* in = message.data();
+            for(int first = 0; first < n; first += INT8_BLOCK){
+                int last = min(n, first + INT8_BLOCK);
+
+                float scale;
+                memcpy(&scale, in, sizeof(scale));
+                in += sizeof(scale);
+
+                for(int i = first; i < last; i++)
+                    gradients[i] = scale * (int8_t)*in++;
+            }
+            break;
+        }
+
+        default:
+            memcpy(gradients.data(), message.data(), (size_t)n * sizeof(accumulator));
+    }
+}
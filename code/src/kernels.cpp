@@ -0,0 +1,221 @@
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+#include "kernels.h"
+
+/**
+ * @brief Input value: real inputs as they are, bytes widened and scaled
+ */
+static inline accumulator input(real x, accumulator) {return x;}
+static inline accumulator input(unsigned char x, accumulator scale) {return (accumulator)x * scale;}
+
+/**
+ * @brief R x C block of dot products, each one accumulated like scalar_dot
+ */
+template <int R, int C, class A>
+static inline void scalar_tile(const A* a, int sa, const real* b, int sb,
+                               real* c, int sc, int n, accumulator scale){
+    accumulator sum[R][C];
+    for(int r = 0; r < R; r++)
+        for(int j = 0; j < C; j++)
+            sum[r][j] = c[r * sc + j];
+
+    //R*C independent sums hide the latency of the additions
+    for(int i = 0; i < n; i++)
+        for(int r = 0; r < R; r++)
+            for(int j = 0; j < C; j++)
+                sum[r][j] += input(a[r * sa + i], scale) * b[j * sb + i];
+
+    for(int r = 0; r < R; r++)
+        for(int j = 0; j < C; j++)
+            c[r * sc + j] = (real)sum[r][j];
+}
+
+template <class A>
+static inline accumulator scalar_dot_any(const A* a, accumulator scale, const real* b, int n, accumulator init){
+    accumulator sum = init;
+    for(int i = 0; i < n; i++)
+        sum += input(a[i], scale) * b[i];
+    return sum;
+}
+
+template <class A>
+static void scalar_block(const A* a, int sa, accumulator scale, const real* b, int sb,
+                         real* c, int sc, int rows, int cols, int n){
+    int r = 0;
+    for(; r + 4 <= rows; r += 4){
+        int j = 0;
+        for(; j + 4 <= cols; j += 4)
+            scalar_tile<4, 4>(a + (size_t)r * sa, sa, b + (size_t)j * sb, sb, c + (size_t)r * sc + j, sc, n, scale);
+        for(; j < cols; j++)
+            scalar_tile<4, 1>(a + (size_t)r * sa, sa, b + (size_t)j * sb, sb, c + (size_t)r * sc + j, sc, n, scale);
+    }
+    //Remaining rows
+    for(; r < rows; r++){
+        int j = 0;
+        for(; j + 4 <= cols; j += 4)
+            scalar_tile<1, 4>(a + (size_t)r * sa, sa, b + (size_t)j * sb, sb, c + (size_t)r * sc + j, sc, n, scale);
+        for(; j < cols; j++)
+            scalar_tile<1, 1>(a + (size_t)r * sa, sa, b + (size_t)j * sb, sb, c + (size_t)r * sc + j, sc, n, scale);
+    }
+}
+
+static accumulator scalar_dot(const real* a, const real* b, int n, accumulator init){
+    return scalar_dot_any(a, 1, b, n, init);
+}
+
+static accumulator scalar_dot_bytes(const unsigned char* a, real scale, const real* b, int n, accumulator init){
+    return scalar_dot_any(a, scale, b, n, init);
+}
+
+static void scalar_dot_block(const real* a, int sa, const real* b, int sb,
+                             real* c, int sc, int rows, int cols, int n){
+    scalar_block(a, sa, 1, b, sb, c, sc, rows, cols, n);
+}
+
+static void scalar_dot_block_bytes(const unsigned char* a, int sa, real scale, const real* b, int sb,
+                                   real* c, int sc, int rows, int cols, int n){
+    scalar_block(a, sa, scale, b, sb, c, sc, rows, cols, n);
+}
+
+static void scalar_axpy(real factor, const real* x, real* y, int n){
+    for(int i = 0; i < n; i++)
+        y[i] += factor * x[i];
+}
+
+static void scalar_accumulate(accumulator factor, const real* x, accumulator* g, int n){
+    for(int i = 0; i < n; i++)
+        g[i] += factor * x[i];
+}
+
+static void scalar_accumulate_bytes(accumulator factor, const unsigned char* x, real scale, accumulator* g, int n){
+    for(int i = 0; i < n; i++)
+        g[i] += factor * input(x[i], scale);
+}
+
+static void scalar_update(real* w, accumulator* g, int n, real learning_rate, real batch_size){
+    for(int i = 0; i < n; i++){
+        w[i] -= learning_rate * (g[i] / batch_size);
+        g[i] = 0;
+    }
+}
+
+static void scalar_merge(accumulator* x, accumulator* y, int n){
+    for(int i = 0; i < n; i++){
+        y[i] += x[i];
+        x[i] = 0;
+    }
+}
+
+static int scalar_expand_bytes(const unsigned char* mask, const unsigned char* values, unsigned char* out, int n){
+    int used = 0;
+    for(int i = 0; i < n; i++){
+        int set = mask[i >> 3] >> (i & 7) & 1;
+        out[i] = (unsigned char)(values[used] & -set); //No branches, the mask is random
+        used += set;
+    }
+    return used;
+}
+
+const kernel_table scalar_kernels = {isa::scalar, scalar_dot, scalar_dot_block, scalar_axpy,
+                                     scalar_accumulate, scalar_update,
+                                     scalar_dot_bytes, scalar_dot_block_bytes, scalar_accumulate_bytes,
+                                     scalar_merge, scalar_expand_bytes};
+
+const char* isa_name(isa type){
+    switch(type){
+        case isa::sse2: return "sse2";
+        case isa::avx2: return "avx2";
+        case isa::avx512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+bool parse_isa(const string& name, isa& type){
+    for(isa t : {isa::scalar, isa::sse2, isa::avx2, isa::avx512})
+        if(name == isa_name(t)){
+            type = t;
+            return true;
+        }
+    return false;
+}
+
+bool isa_supported(isa type){
+    switch(type){
+        case isa::scalar: return true;
+#ifdef NN_X86_KERNELS
+        //CPUID (and OS support of the registers) is checked by the compiler runtime
+        case isa::sse2: return __builtin_cpu_supports("sse2");
+        case isa::avx2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case isa::avx512: return __builtin_cpu_supports("avx512f");
+#endif
+        default: return false;
+    }
+}
+
+isa best_isa(){
+    for(isa t : {isa::avx512, isa::avx2, isa::sse2})
+        if(isa_supported(t)) return t;
+    return isa::scalar;
+}
+
+/**
+ * @brief Table of an instruction set (must be supported)
+ */
+static const kernel_table* table(isa type){
+    switch(type){
+#ifdef NN_X86_KERNELS
+        case isa::sse2: return &sse2_kernels;
+        case isa::avx2: return &avx2_kernels;
+        case isa::avx512:
+            //The byte expand of VBMI2 where the CPU has it
+            if(__builtin_cpu_supports("avx512vbmi2") && __builtin_cpu_supports("avx512bw")) return &avx512_vbmi2_kernels;
+            return &avx512_kernels;
+#endif
+        default: return &scalar_kernels;
+    }
+}
+
+/**
+ * @brief Instruction set used on start: NN_ISA if set and supported, the best one otherwise
+ */
+static const kernel_table* initial_table(){
+    isa type = best_isa();
+
+    const char* forced = getenv("NN_ISA");
+    if(forced != nullptr){
+        isa aux;
+        if(!parse_isa(forced, aux))
+            cerr << "Unknown NN_ISA value: " << forced << ", using " << isa_name(type) << endl;
+        else if(!isa_supported(aux))
+            cerr << "NN_ISA=" << forced << " not supported by this CPU, using " << isa_name(type) << endl;
+        else
+            type = aux;
+    }
+
+    return table(type);
+}
+
+static atomic<const kernel_table*> selected(nullptr); //*< Kernels in use */
+
+const kernel_table& kernels(){
+    const kernel_table* current = selected.load(memory_order_acquire);
+
+    if(current == nullptr){
+        //Thread safe one time initialization
+        static const kernel_table* initial = initial_table();
+        const kernel_table* expected = nullptr;
+        selected.compare_exchange_strong(expected, initial, memory_order_acq_rel);
+        current = selected.load(memory_order_acquire);
+    }
+
+    return *current;
+}
+
+bool set_isa(isa type){
+    if(!isa_supported(type)) return false;
+
+    selected.store(table(type), memory_order_release);
+    return true;
+}
@@ -0,0 +1,77 @@
+#include "kernels.h"
+
+#ifdef NN_X86_KERNELS
+
+#include <cstring>
+#include <immintrin.h>
+
+#include "kernels_simd.h"
+
+/**
+ * @brief AVX2 vector of accumulators (multiply-adds are fused)
+ */
+template <class T>
+struct avx2_vec;
+
+/**
+ * @brief AVX2 vector of 4 doubles (float arrays are widened on load)
+ */
+template <>
+struct avx2_vec<double> {
+    using type = __m256d;
+    static const int width = 4;
+    static const int tile_rows = 2, tile_cols = 4;
+
+    static inline type zero() {return _mm256_setzero_pd();}
+    static inline type set(double x) {return _mm256_set1_pd(x);}
+    static inline type load(const double* p) {return _mm256_loadu_pd(p);}
+    static inline type load(const float* p) {return _mm256_cvtps_pd(_mm_loadu_ps(p));}
+    static inline type load(const unsigned char* p) {
+        int aux;
+        memcpy(&aux, p, sizeof(aux));
+        return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(aux)));
+    }
+    static inline void store(double* p, type x) {_mm256_storeu_pd(p, x);}
+    static inline void store(float* p, type x) {_mm_storeu_ps(p, _mm256_cvtpd_ps(x));}
+    static inline type mul_add(type a, type b, type c) {return _mm256_fmadd_pd(a, b, c);}
+    static inline type add(type a, type b) {return _mm256_add_pd(a, b);}
+    static inline type sub(type a, type b) {return _mm256_sub_pd(a, b);}
+    static inline type mul(type a, type b) {return _mm256_mul_pd(a, b);}
+    static inline type div(type a, type b) {return _mm256_div_pd(a, b);}
+    static inline double reduce(type x) {
+        __m128d aux = _mm_add_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(aux, _mm_unpackhi_pd(aux, aux)));
+    }
+};
+
+/**
+ * @brief AVX2 vector of 8 floats
+ */
+template <>
+struct avx2_vec<float> {
+    using type = __m256;
+    static const int width = 8;
+    static const int tile_rows = 2, tile_cols = 4;
+
+    static inline type zero() {return _mm256_setzero_ps();}
+    static inline type set(float x) {return _mm256_set1_ps(x);}
+    static inline type load(const float* p) {return _mm256_loadu_ps(p);}
+    static inline type load(const unsigned char* p) {
+        return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+    }
+    static inline void store(float* p, type x) {_mm256_storeu_ps(p, x);}
+    static inline type mul_add(type a, type b, type c) {return _mm256_fmadd_ps(a, b, c);}
+    static inline type add(type a, type b) {return _mm256_add_ps(a, b);}
+    static inline type sub(type a, type b) {return _mm256_sub_ps(a, b);}
+    static inline type mul(type a, type b) {return _mm256_mul_ps(a, b);}
+    static inline type div(type a, type b) {return _mm256_div_ps(a, b);}
+    static inline float reduce(type x) {
+        __m128 aux = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+        aux = _mm_add_ps(aux, _mm_movehl_ps(aux, aux));
+        return _mm_cvtss_f32(_mm_add_ss(aux, _mm_shuffle_ps(aux, aux, 1)));
+    }
+};
+
+const kernel_table avx2_kernels = simd_kernels<avx2_vec<accumulator>>::table(isa::avx2);
+
+#endif
@@ -0,0 +1,114 @@
+#include "kernels.h"
+
+#ifdef NN_X86_KERNELS
+
+#include <cstring>
+#include <immintrin.h>
+
+#include "kernels_simd.h"
+
+/**
+ * @brief AVX-512 vector of accumulators (multiply-adds are fused)
+ */
+template <class T>
+struct avx512_vec;
+
+/**
+ * @brief AVX-512 vector of 8 doubles (float arrays are widened on load)
+ */
+template <>
+struct avx512_vec<double> {
+    using type = __m512d;
+    static const int width = 8;
+    static const int tile_rows = 4, tile_cols = 4;
+
+    static inline type zero() {return _mm512_setzero_pd();}
+    static inline type set(double x) {return _mm512_set1_pd(x);}
+    static inline type load(const double* p) {return _mm512_loadu_pd(p);}
+    static inline type load(const float* p) {return _mm512_cvtps_pd(_mm256_loadu_ps(p));}
+    static inline type load(const unsigned char* p) {
+        return _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+    }
+    static inline void store(double* p, type x) {_mm512_storeu_pd(p, x);}
+    static inline void store(float* p, type x) {_mm256_storeu_ps(p, _mm512_cvtpd_ps(x));}
+    static inline type mul_add(type a, type b, type c) {return _mm512_fmadd_pd(a, b, c);}
+    static inline type add(type a, type b) {return _mm512_add_pd(a, b);}
+    static inline type sub(type a, type b) {return _mm512_sub_pd(a, b);}
+    static inline type mul(type a, type b) {return _mm512_mul_pd(a, b);}
+    static inline type div(type a, type b) {return _mm512_div_pd(a, b);}
+    static inline double reduce(type x) {
+        __m256d aux4 = _mm256_add_pd(_mm512_castpd512_pd256(x), _mm512_extractf64x4_pd(x, 1));
+        __m128d aux2 = _mm_add_pd(_mm256_castpd256_pd128(aux4), _mm256_extractf128_pd(aux4, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(aux2, _mm_unpackhi_pd(aux2, aux2)));
+    }
+};
+
+/**
+ * @brief AVX-512 vector of 16 floats
+ */
+template <>
+struct avx512_vec<float> {
+    using type = __m512;
+    static const int width = 16;
+    static const int tile_rows = 4, tile_cols = 4;
+
+    static inline type zero() {return _mm512_setzero_ps();}
+    static inline type set(float x) {return _mm512_set1_ps(x);}
+    static inline type load(const float* p) {return _mm512_loadu_ps(p);}
+    static inline type load(const unsigned char* p) {
+        return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)p)));
+    }
+    static inline void store(float* p, type x) {_mm512_storeu_ps(p, x);}
+    static inline type mul_add(type a, type b, type c) {return _mm512_fmadd_ps(a, b, c);}
+    static inline type add(type a, type b) {return _mm512_add_ps(a, b);}
+    static inline type sub(type a, type b) {return _mm512_sub_ps(a, b);}
+    static inline type mul(type a, type b) {return _mm512_mul_ps(a, b);}
+    static inline type div(type a, type b) {return _mm512_div_ps(a, b);}
+    static inline float reduce(type x) {
+        //Only AVX-512F: the upper half is moved down through the double view
+        __m256 high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1));
+        __m256 aux8 = _mm256_add_ps(_mm512_castps512_ps256(x), high);
+        __m128 aux = _mm_add_ps(_mm256_castps256_ps128(aux8), _mm256_extractf128_ps(aux8, 1));
+        aux = _mm_add_ps(aux, _mm_movehl_ps(aux, aux));
+        return _mm_cvtss_f32(_mm_add_ss(aux, _mm_shuffle_ps(aux, aux, 1)));
+    }
+};
+
+/**
+ * @brief expand_bytes with AVX-512 VBMI2: 64 pixels per byte expand of the values
+ * @details Only the values used are read, the expand loads are masked
+ */
+__attribute__((target("avx512f,avx512bw,avx512vbmi2,popcnt")))
+static int vbmi2_expand_bytes(const unsigned char* mask, const unsigned char* values, unsigned char* out, int n){
+    int used = 0, i = 0;
+    for(; i + 64 <= n; i += 64){
+        unsigned long long m;
+        memcpy(&m, mask + i / 8, sizeof(m));
+        _mm512_storeu_si512(out + i, _mm512_maskz_expandloadu_epi8(m, values + used));
+        used += (int)_mm_popcnt_u64(m);
+    }
+    if(i < n){
+        unsigned long long m, tail = ~0ull >> (64 - (n - i));
+        memcpy(&m, mask + i / 8, sizeof(m));
+        m &= tail;
+        _mm512_mask_storeu_epi8(out + i, tail, _mm512_maskz_expandloadu_epi8(m, values + used));
+        used += (int)_mm_popcnt_u64(m);
+    }
+    return used;
+}
+
+const kernel_table avx512_kernels = simd_kernels<avx512_vec<accumulator>>::table(isa::avx512);
+
+/**
+ * @brief AVX-512F kernels with the VBMI2 byte expand
+ * @details Built at compile time like every table (no code runs on start), picked by the
+ * dispatcher only once CPUID reports VBMI2
+ */
+static constexpr kernel_table with_vbmi2(kernel_table table){
+    table.expand_bytes = vbmi2_expand_bytes;
+    return table;
+}
+
+const kernel_table avx512_vbmi2_kernels = with_vbmi2(simd_kernels<avx512_vec<accumulator>>::table(isa::avx512));
+
+#endif
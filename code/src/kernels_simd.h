@@ -0,0 +1,240 @@
+#ifndef KERNELS_SIMD_H
+#define KERNELS_SIMD_H
+
+#include "kernels.h"
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+
+/**
+ * @brief Byte shuffle of every 8 bit mask of expand_bytes (0x80 writes a 0) and its number of set bits
+ */
+struct expand_entry {
+    unsigned char shuffle[8]; //*< Value read by each byte (0x80: none) */
+    unsigned char count; //*< Values used */
+};
+
+struct expand_table {
+    expand_entry entries[256];
+
+    constexpr expand_table() : entries() {
+        for(int m = 0; m < 256; m++){
+            int count = 0;
+            for(int b = 0; b < 8; b++)
+                entries[m].shuffle[b] = m >> b & 1 ? (unsigned char)count++ : 0x80;
+            entries[m].count = (unsigned char)count;
+        }
+    }
+};
+
+static constexpr expand_table expand_shuffles;
+#endif
+
+/**
+ * @brief Kernels written once for any vector type
+ * @details V describes a vector of accumulators of an instruction set: type, width, zero,
+ * set, load/store (of float, double or byte arrays, converting to/from the lanes), mul_add
+ * (a * b + c), add, sub, mul, div, reduce (fixed order horizontal sum) and the register tile
+ * (tile_rows x tile_cols) used by dot_block.
+ * Only included by the kernels_<isa>.cpp files, which are compiled for that instruction set
+ */
+template <class V>
+struct simd_kernels {
+    using vec = typename V::type;
+
+    /**
+     * @brief Load an input vector: real arrays as they are, bytes widened and scaled
+     */
+    static inline vec load_input(const real* p, vec) {return V::load(p);}
+    static inline vec load_input(const unsigned char* p, vec scale) {return V::mul(V::load(p), scale);}
+
+    /**
+     * @brief Scalar version of load_input
+     */
+    static inline accumulator input(real x, accumulator) {return x;}
+    static inline accumulator input(unsigned char x, accumulator scale) {return (accumulator)x * scale;}
+
+    /**
+     * @brief R x C block of dot products, each one accumulated exactly like dot
+     */
+    template <int R, int C, class A>
+    static inline void tile(const A* a, int sa, const real* b, int sb,
+                            accumulator* c, int sc, int n, accumulator scale){
+        const int vn = n - n % V::width;
+        const vec vscale = V::set(scale);
+
+        vec acc[R][C];
+        for(int r = 0; r < R; r++)
+            for(int j = 0; j < C; j++)
+                acc[r][j] = V::zero();
+
+        for(int i = 0; i < vn; i += V::width){
+            vec va[R];
+            for(int r = 0; r < R; r++)
+                va[r] = load_input(a + (size_t)r * sa + i, vscale);
+            for(int j = 0; j < C; j++){
+                vec vb = V::load(b + (size_t)j * sb + i);
+                for(int r = 0; r < R; r++)
+                    acc[r][j] = V::mul_add(va[r], vb, acc[r][j]);
+            }
+        }
+
+        for(int r = 0; r < R; r++)
+            for(int j = 0; j < C; j++){
+                accumulator sum = c[r * sc + j] + V::reduce(acc[r][j]);
+                for(int i = vn; i < n; i++)
+                    sum += input(a[(size_t)r * sa + i], scale) * b[(size_t)j * sb + i];
+                c[r * sc + j] = sum;
+            }
+    }
+
+    /**
+     * @brief R x C block of dot products written to real outputs
+     */
+    template <int R, int C, class A>
+    static inline void real_tile(const A* a, int sa, const real* b, int sb,
+                                 real* c, int sc, int n, accumulator scale){
+        accumulator sum[R * C];
+        for(int r = 0; r < R; r++)
+            for(int j = 0; j < C; j++)
+                sum[r * C + j] = c[(size_t)r * sc + j];
+
+        tile<R, C>(a, sa, b, sb, sum, C, n, scale);
+
+        for(int r = 0; r < R; r++)
+            for(int j = 0; j < C; j++)
+                c[(size_t)r * sc + j] = (real)sum[r * C + j];
+    }
+
+    /**
+     * @brief Block of dot products of any input type
+     */
+    template <class A>
+    static inline void block(const A* a, int sa, const real* b, int sb,
+                             real* c, int sc, int rows, int cols, int n, accumulator scale){
+        const int R = V::tile_rows, C = V::tile_cols;
+
+        int r = 0;
+        for(; r + R <= rows; r += R){
+            int j = 0;
+            for(; j + C <= cols; j += C)
+                real_tile<R, C>(a + (size_t)r * sa, sa, b + (size_t)j * sb, sb, c + (size_t)r * sc + j, sc, n, scale);
+            for(; j < cols; j++)
+                real_tile<R, 1>(a + (size_t)r * sa, sa, b + (size_t)j * sb, sb, c + (size_t)r * sc + j, sc, n, scale);
+        }
+        //Remaining rows
+        for(; r < rows; r++){
+            int j = 0;
+            for(; j + C <= cols; j += C)
+                real_tile<1, C>(a + (size_t)r * sa, sa, b + (size_t)j * sb, sb, c + (size_t)r * sc + j, sc, n, scale);
+            for(; j < cols; j++)
+                real_tile<1, 1>(a + (size_t)r * sa, sa, b + (size_t)j * sb, sb, c + (size_t)r * sc + j, sc, n, scale);
+        }
+    }
+
+    static accumulator dot(const real* a, const real* b, int n, accumulator init){
+        accumulator sum = init;
+        tile<1, 1>(a, 0, b, 0, &sum, 0, n, 1);
+        return sum;
+    }
+
+    static accumulator dot_bytes(const unsigned char* a, real scale, const real* b, int n, accumulator init){
+        accumulator sum = init;
+        tile<1, 1>(a, 0, b, 0, &sum, 0, n, scale);
+        return sum;
+    }
+
+    static void dot_block(const real* a, int sa, const real* b, int sb,
+                          real* c, int sc, int rows, int cols, int n){
+        block(a, sa, b, sb, c, sc, rows, cols, n, 1);
+    }
+
+    static void dot_block_bytes(const unsigned char* a, int sa, real scale, const real* b, int sb,
+                                real* c, int sc, int rows, int cols, int n){
+        block(a, sa, b, sb, c, sc, rows, cols, n, scale);
+    }
+
+    /**
+     * @brief y[i] += factor * x[i] computed in the lanes of V
+     */
+    template <class X, class Y>
+    static inline void scaled_add(accumulator factor, const X* x, accumulator scale, Y* y, int n){
+        const int vn = n - n % V::width;
+        const vec f = V::set(factor), vscale = V::set(scale);
+
+        for(int i = 0; i < vn; i += V::width)
+            V::store(y + i, V::mul_add(f, load_input(x + i, vscale), V::load(y + i)));
+        for(int i = vn; i < n; i++)
+            y[i] = (Y)(y[i] + factor * input(x[i], scale));
+    }
+
+    static void axpy(real factor, const real* x, real* y, int n){
+        scaled_add(factor, x, 1, y, n);
+    }
+
+    static void accumulate(accumulator factor, const real* x, accumulator* g, int n){
+        scaled_add(factor, x, 1, g, n);
+    }
+
+    static void accumulate_bytes(accumulator factor, const unsigned char* x, real scale, accumulator* g, int n){
+        scaled_add(factor, x, scale, g, n);
+    }
+
+    static void update(real* w, accumulator* g, int n, real learning_rate, real batch_size){
+        const int vn = n - n % V::width;
+        const vec lr = V::set(learning_rate), bs = V::set(batch_size);
+
+        for(int i = 0; i < vn; i += V::width){
+            V::store(w + i, V::sub(V::load(w + i), V::mul(lr, V::div(V::load(g + i), bs))));
+            V::store(g + i, V::zero());
+        }
+        for(int i = vn; i < n; i++){
+            w[i] -= learning_rate * (g[i] / batch_size);
+            g[i] = 0;
+        }
+    }
+
+    static void merge(accumulator* x, accumulator* y, int n){
+        const int vn = n - n % V::width;
+
+        for(int i = 0; i < vn; i += V::width){
+            V::store(y + i, V::add(V::load(y + i), V::load(x + i)));
+            V::store(x + i, V::zero());
+        }
+        for(int i = vn; i < n; i++){
+            y[i] += x[i];
+            x[i] = 0;
+        }
+    }
+
+    static int expand_bytes(const unsigned char* mask, const unsigned char* values, unsigned char* out, int n){
+        int used = 0, i = 0;
+#ifdef __SSSE3__
+        //8 pixels at a time: the next 8 values are spread over the set bits by a byte shuffle
+        for(; i + 8 <= n; i += 8){
+            const expand_entry& e = expand_shuffles.entries[mask[i >> 3]];
+            __m128i v = _mm_loadl_epi64((const __m128i*)(values + used));
+            __m128i s = _mm_loadl_epi64((const __m128i*)e.shuffle);
+            _mm_storel_epi64((__m128i*)(out + i), _mm_shuffle_epi8(v, s));
+            used += e.count;
+        }
+#endif
+        //No byte shuffles in SSE2
+        for(; i < n; i++){
+            int set = mask[i >> 3] >> (i & 7) & 1;
+            out[i] = (unsigned char)(values[used] & -set); //No branches, the mask is random
+            used += set;
+        }
+        return used;
+    }
+
+    /**
+     * @brief Table with the kernels of this instruction set
+     */
+    static constexpr kernel_table table(isa type){
+        return {type, dot, dot_block, axpy, accumulate, update,
+                dot_bytes, dot_block_bytes, accumulate_bytes, merge, expand_bytes};
+    }
+};
+
+#endif
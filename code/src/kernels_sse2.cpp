@@ -0,0 +1,83 @@
+#include "kernels.h"
+
+#ifdef NN_X86_KERNELS
+
+#include <cstring>
+#include <emmintrin.h>
+
+#include "kernels_simd.h"
+
+/**
+ * @brief SSE2 vector of accumulators
+ */
+template <class T>
+struct sse2_vec;
+
+/**
+ * @brief SSE2 vector of 2 doubles (float arrays are widened on load)
+ */
+template <>
+struct sse2_vec<double> {
+    using type = __m128d;
+    static const int width = 2;
+    static const int tile_rows = 2, tile_cols = 4;
+
+    static inline type zero() {return _mm_setzero_pd();}
+    static inline type set(double x) {return _mm_set1_pd(x);}
+    static inline type load(const double* p) {return _mm_loadu_pd(p);}
+    static inline type load(const float* p) {
+        return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)p)));
+    }
+    static inline type load(const unsigned char* p) {
+        unsigned short aux;
+        memcpy(&aux, p, sizeof(aux));
+        __m128i bytes = _mm_cvtsi32_si128(aux);
+        __m128i ints = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, _mm_setzero_si128()), _mm_setzero_si128());
+        return _mm_cvtepi32_pd(ints);
+    }
+    static inline void store(double* p, type x) {_mm_storeu_pd(p, x);}
+    static inline void store(float* p, type x) {_mm_storel_epi64((__m128i*)p, _mm_castps_si128(_mm_cvtpd_ps(x)));}
+    static inline type mul_add(type a, type b, type c) {return _mm_add_pd(_mm_mul_pd(a, b), c);}
+    static inline type add(type a, type b) {return _mm_add_pd(a, b);}
+    static inline type sub(type a, type b) {return _mm_sub_pd(a, b);}
+    static inline type mul(type a, type b) {return _mm_mul_pd(a, b);}
+    static inline type div(type a, type b) {return _mm_div_pd(a, b);}
+    static inline double reduce(type x) {
+        return _mm_cvtsd_f64(_mm_add_sd(x, _mm_unpackhi_pd(x, x)));
+    }
+};
+
+/**
+ * @brief SSE2 vector of 4 floats
+ */
+template <>
+struct sse2_vec<float> {
+    using type = __m128;
+    static const int width = 4;
+    static const int tile_rows = 2, tile_cols = 4;
+
+    static inline type zero() {return _mm_setzero_ps();}
+    static inline type set(float x) {return _mm_set1_ps(x);}
+    static inline type load(const float* p) {return _mm_loadu_ps(p);}
+    static inline type load(const unsigned char* p) {
+        int aux;
+        memcpy(&aux, p, sizeof(aux));
+        __m128i bytes = _mm_cvtsi32_si128(aux);
+        __m128i ints = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, _mm_setzero_si128()), _mm_setzero_si128());
+        return _mm_cvtepi32_ps(ints);
+    }
+    static inline void store(float* p, type x) {_mm_storeu_ps(p, x);}
+    static inline type mul_add(type a, type b, type c) {return _mm_add_ps(_mm_mul_ps(a, b), c);}
+    static inline type add(type a, type b) {return _mm_add_ps(a, b);}
+    static inline type sub(type a, type b) {return _mm_sub_ps(a, b);}
+    static inline type mul(type a, type b) {return _mm_mul_ps(a, b);}
+    static inline type div(type a, type b) {return _mm_div_ps(a, b);}
+    static inline float reduce(type x) {
+        __m128 aux = _mm_add_ps(x, _mm_movehl_ps(x, x));
+        return _mm_cvtss_f32(_mm_add_ss(aux, _mm_shuffle_ps(aux, aux, 1)));
+    }
+};
+
+const kernel_table sse2_kernels = simd_kernels<sse2_vec<accumulator>>::table(isa::sse2);
+
+#endif
@@ -3,6 +3,7 @@
 //
 
 #include "layer.h"
+#include "kernels.h"
 using namespace std;
 
 
@@ -10,20 +11,19 @@ layer::layer(int nodes, int inputs, const activation& activation_function) {
     this->nodes = nodes;
     this->inputs = inputs;
 
-    this->bias = vector<double>(this->nodes,0.01);
+    this->bias = aligned_vector<real>(this->nodes,0.01);
 
-    this->outputs = vector<double>(this->nodes);
-    this->deltas = vector<double>(this->nodes);
+    this->outputs = aligned_vector<real>(this->nodes);
+    this->deltas = aligned_vector<real>(this->nodes);
 
     this->activation_function = activation_function;
+    this->input_scale = 1;
+    this->pool = nullptr;
+    this->parallel_threshold = PARALLEL_THRESHOLD;
 
     //Initialize weights with random values
-    weights.resize(this->nodes);
-    for(vector<double>& node : weights){
-        node.resize(inputs);
-        for(double& w : node)
-            w = random_double();
-    }
+    weights = matrix(this->nodes, this->inputs);
+    randomize();
 }
 layer::layer(const layer& other) {
     *this = other;
@@ -33,47 +33,65 @@ void layer::set_activation_function(const activation& new_activation){
     this->activation_function = new_activation;
 }
 
+void layer::set_thread_pool(thread_pool* shared_pool, long threshold){
+    this->pool = shared_pool;
+    this->parallel_threshold = threshold;
+}
+
 void layer::set_nodes(int num_nodes){
     layer aux(num_nodes, this->inputs, activation_function);
+    aux.input_scale = input_scale;
+    aux.set_thread_pool(pool, parallel_threshold);
 
     *this = aux;
 }
 void layer::set_inputs(int num_inputs){
     layer aux(this->nodes, num_inputs, activation_function);
+    aux.input_scale = input_scale;
+    aux.set_thread_pool(pool, parallel_threshold);
 
     *this = aux;
 }
 void layer::add_node(){
-    weights.emplace_back(inputs);
+    weights.resize(nodes + 1, inputs);
+
+    for(real& w : weights.row(nodes))
+        w = random_real();
 
-    for(double& w : weights.back())
-        w = random_double();
+    bias.push_back(0.01);
+    outputs.push_back(0);
+    deltas.push_back(0);
 
     nodes++;
 }
 void layer::remove_node(){
     if(nodes > 0) {
-        weights.pop_back();
+        weights.resize(nodes - 1, inputs);
+        bias.pop_back();
+        outputs.pop_back();
+        deltas.pop_back();
         nodes--;
     }
 }
 void layer::add_input(){
-    for(vector<double>& node : weights)
-        node.push_back(random_double());
+    //Only moves memory when the rows run out of padding
+    weights.resize(nodes, inputs + 1);
+
+    for(int node = 0; node < nodes; node++)
+        weights(node, inputs) = random_real();
 
     inputs++;
 }
 void layer::remove_input(){
     if(inputs != 0) {
-        for (vector<double>& node: weights)
-            node.pop_back();
+        weights.resize(nodes, inputs - 1);
         inputs--;
     }
 }
 
 void layer::show_weights() const {
-    for(const vector<double>& v : weights) {
-        for (double d: v)
+    for(int node = 0; node < nodes; node++) {
+        for (real d: weights.row(node))
             cout << d << " ";
         cout<<endl;
     }
@@ -81,147 +99,393 @@ void layer::show_weights() const {
 
 void layer::randomize() {
     //Randomize all weights
-    for(vector<double>& v : weights)
-        for(double& d : v)
-            d = random_double();
+    for(int node = 0; node < nodes; node++)
+        for(real& d : weights.row(node))
+            d = random_real();
 }
 
-const vector<double>& layer::calculate_outputs (const vector<unsigned char>& input_vector){
-    //Convert input vector to double
-    vector<double> aux = vector<double>(input_vector.size());
+array_view<const real> layer::calculate_outputs (array_view<const unsigned char> input_vector){
+    calculate_outputs(input_vector, outputs);
 
-    //Copy values (unefficient)
-    for(int i = 0; i < aux.size(); i++)
-        aux[i] = input_vector[i];
+    return outputs;
+}
 
-    //Forward pass
-    calculate_outputs(aux);
+array_view<const real> layer::calculate_outputs (array_view<const real> input_vector) {
+    calculate_outputs(input_vector, outputs);
 
     return outputs;
 }
 
-const vector<double>& layer::calculate_outputs (const vector<double>& input_vector) {
-    for (int node = 0; node < this->nodes; node++) {
-        //The bias is added
-        outputs[node] = bias[node];
+void layer::calculate_outputs(array_view<const real> input_vector, array_view<real> output) const {
+    const kernel_table& kernel = kernels();
 
-        //To the output of the node, the weighted sum of the inputs is added
-        for (int i = 0; i < this->inputs; i++)
-            outputs[node] += input_vector[i] * weights[node][i];
+    for_nodes([&](int first, int last){
+        for (int node = first; node < last; node++) {
+            //The weighted sum of the inputs is added to the bias (weights of the node are contiguous)
+            accumulator sum = kernel.dot(input_vector.data(), weights.row(node).data(), this->inputs, bias[node]);
 
-        //Then the activation function is applied
-        outputs[node] = activation_function.function(outputs[node]);
-    }
+            //Then the activation function is applied
+            output[node] = activation_function.function((real)sum);
+        }
+    });
+}
 
-    return outputs;
+void layer::calculate_outputs(array_view<const unsigned char> input_vector, array_view<real> output) const {
+    const kernel_table& kernel = kernels();
+
+    for_nodes([&](int first, int last){
+        for (int node = first; node < last; node++) {
+            //Same as the real version, the bytes are widened and scaled in registers
+            accumulator sum = kernel.dot_bytes(input_vector.data(), input_scale, weights.row(node).data(),
+                                               this->inputs, bias[node]);
+
+            //Then the activation function is applied
+            output[node] = activation_function.function((real)sum);
+        }
+    });
+}
+
+void layer::calculate_outputs(const sparse_vector& input_vector, array_view<real> output) const {
+    for_nodes([&](int first, int last){
+        for (int node = first; node < last; node++) {
+            const real* w = weights.row(node).data();
+
+            //Only the non zero inputs add to the bias
+            accumulator sum = bias[node];
+            for(int i = 0; i < input_vector.count; i++)
+                sum += (accumulator)input_vector.values[i] * input_scale * w[input_vector.indices[i]];
+
+            //Then the activation function is applied
+            output[node] = activation_function.function((real)sum);
+        }
+    });
+}
+
+const matrix& layer::calculate_outputs(const matrix& inputs, layer_buffers& buffers) const {
+    //out = f(inputs * weights^T + bias)
+    multiply_transposed(inputs, weights, buffers.outputs, bias.data(), activation_function.function);
+
+    return buffers.outputs;
+}
+
+const matrix& layer::calculate_outputs(const byte_matrix& inputs, layer_buffers& buffers) const {
+    //out = f((inputs * scale) * weights^T + bias), without converting the inputs first
+    multiply_transposed(inputs, input_scale, weights, buffers.outputs, bias.data(), activation_function.function);
+
+    return buffers.outputs;
+}
+
+const matrix& layer::calculate_outputs(const sparse_matrix& inputs, layer_buffers& buffers) const {
+    //out = f((inputs * scale) * weights^T + bias), reading only the weights of non zero inputs
+    multiply_transposed(inputs, input_scale, weights, buffers.outputs, bias.data(), activation_function.function);
+
+    return buffers.outputs;
 }
 
-void layer::calculate_output_gradient(const vector<double>& input,
-                                      const vector<double>& expected_outputs){
+const matrix& layer::calculate_outputs(const matrix& inputs){
+    return calculate_outputs(inputs, buffers);
+}
+
+const matrix& layer::calculate_outputs(const byte_matrix& inputs){
+    return calculate_outputs(inputs, buffers);
+}
+
+const matrix& layer::calculate_outputs(const sparse_matrix& inputs){
+    return calculate_outputs(inputs, buffers);
+}
+
+void layer::calculate_output_deltas(const vector<real>& expected_outputs){
     for(int i = 0; i < this->nodes; i++){
         //Calculate the delta of the node (deltas are used in backpropagation, chain rule)
         this->deltas[i] = d_node_cost(outputs[i], expected_outputs[i]) *
                             activation_function.derivative(outputs[i]);
-        
-        //Calculate the gradient of the bias and the weights
-        this->bias_gradients[i] += this->deltas[i];
 
-        //For each weight, the gradient is calculated
-        for(int j = 0; j < this->inputs; j++)
-            this->weight_gradients[i][j] += this->deltas[i] * input[j];
+        //Calculate the gradient of the bias
+        buffers.bias_gradients[i] += this->deltas[i];
     }
 }
 
-void layer::calculate_output_gradient(const vector<unsigned char>& input,
-                                      const vector<double>& expected_outputs){
-    //Convert input vector to double
-    vector<double> aux = vector<double>(input.size());
+void layer::calculate_hidden_deltas(const layer& previous_layer){
+    //Sum of the deltas of the previous layer weighted by the connections (rows of its weights)
+    transposed_multiply(previous_layer.weights, previous_layer.deltas, this->deltas);
 
-    //Copy values (unefficient)
-    for(int i = 0; i < aux.size(); i++)
-        aux[i] = input[i];
+    //For each node in the layer
+    for(int i = 0; i < nodes; i++){
+        //Multiply the sum by the derivative of the activation function
+        this->deltas[i] *= activation_function.derivative(outputs[i]);
 
-    //Call the double version of the function
-    calculate_output_gradient(aux,expected_outputs);
+        //Calculate the gradient of the bias
+        buffers.bias_gradients[i] += deltas[i];
+    }
 }
 
-void layer::calculate_hidden_gradient(const vector<double>& input,
-                                      const layer& previous_layer){
+void layer::add_weight_gradients(array_view<const real> input){
+    const kernel_table& kernel = kernels();
 
-    //For each node in the layer
-    for(int i = 0; i < nodes; i++){
-        //Initialize delta to 0
-        double aux = 0;
-        this->deltas[i] = 0;
+    //For each weight, the gradient is calculated using the delta
+    for_nodes([&](int first, int last){
+        for(int i = first; i < last; i++)
+            kernel.accumulate(this->deltas[i], input.data(), buffers.weight_gradients.row(i).data(), this->inputs);
+    });
+}
+
+void layer::add_weight_gradients(array_view<const unsigned char> input){
+    const kernel_table& kernel = kernels();
 
-        //For each node in the previous layer
-        for(int j = 0; j < previous_layer.nodes; j++)
-            //Add the delta of the previous layer node multiplied by the weight of the connection
-            aux += previous_layer.deltas[j] * previous_layer.weights[j][i];
+    //Same as the real version, reading the bytes directly
+    for_nodes([&](int first, int last){
+        for(int i = first; i < last; i++)
+            kernel.accumulate_bytes(this->deltas[i], input.data(), input_scale,
+                                    buffers.weight_gradients.row(i).data(), this->inputs);
+    });
+}
 
-        //Multiply the sum by the derivative of the activation function and store it in the delta of the node
-        this->deltas[i] += aux * activation_function.derivative(outputs[i]);
+void layer::calculate_output_gradient(array_view<const real> input,
+                                      const vector<real>& expected_outputs){
+    calculate_output_deltas(expected_outputs);
+    add_weight_gradients(input);
+}
 
-        //Calculate the gradient of the bias and the weights
-        this->bias_gradients[i] += deltas[i];
+void layer::calculate_output_gradient(array_view<const unsigned char> input,
+                                      const vector<real>& expected_outputs){
+    calculate_output_deltas(expected_outputs);
+    add_weight_gradients(input);
+}
 
-        //For each weight, the gradient is calculated using the delta
-        for(int j = 0; j < this->inputs; j++)
-            this->weight_gradients[i][j] += this->deltas[i] * input[j];
-    }
+void layer::calculate_hidden_gradient(array_view<const real> input,
+                                      const layer& previous_layer){
+    calculate_hidden_deltas(previous_layer);
+    add_weight_gradients(input);
 }
 
-void layer::calculate_hidden_gradient(const vector<unsigned char>& input,
+void layer::calculate_hidden_gradient(array_view<const unsigned char> input,
                                       const layer& previous_layer){
-    //Convert input vector to double
-    vector<double> aux = vector<double>(input.size());
+    calculate_hidden_deltas(previous_layer);
+    add_weight_gradients(input);
+}
+
+void layer::calculate_batch_output_deltas(const matrix& expected_outputs, layer_buffers& buffers) const {
+    const matrix& batch_outputs = buffers.outputs;
+    matrix& batch_deltas = buffers.deltas;
+    const int samples = batch_outputs.get_rows();
+
+    if(batch_deltas.get_rows() != samples || batch_deltas.get_cols() != nodes)
+        batch_deltas = matrix(samples, nodes);
+
+    for(int s = 0; s < samples; s++)
+        for(int i = 0; i < this->nodes; i++){
+            //Calculate the delta of the node for each sample
+            real output = batch_outputs(s, i);
+            batch_deltas(s, i) = d_node_cost(output, expected_outputs(s, i)) *
+                                 activation_function.derivative(output);
+
+            //Calculate the gradient of the bias
+            buffers.bias_gradients[i] += batch_deltas(s, i);
+        }
+}
+
+void layer::calculate_batch_hidden_deltas(const layer& previous_layer, const layer_buffers& previous_buffers,
+                                          layer_buffers& buffers) const {
+    matrix& batch_deltas = buffers.deltas;
+
+    //Sum of the deltas of the previous layer weighted by the connections
+    multiply(previous_buffers.deltas, previous_layer.weights, batch_deltas);
 
-    //Copy values (unefficient)
-    for(int i = 0; i < aux.size(); i++)
-        aux[i] = input[i];
+    for(int s = 0; s < batch_deltas.get_rows(); s++)
+        for(int i = 0; i < this->nodes; i++){
+            //Multiply by the derivative of the activation function
+            batch_deltas(s, i) *= activation_function.derivative(buffers.outputs(s, i));
 
-    //Call the double version of the function
-    calculate_hidden_gradient(aux, previous_layer);
+            //Calculate the gradient of the bias
+            buffers.bias_gradients[i] += batch_deltas(s, i);
+        }
+}
+
+void layer::calculate_output_gradient(const matrix& inputs, const matrix& expected_outputs,
+                                      layer_buffers& buffers) const {
+    calculate_batch_output_deltas(expected_outputs, buffers);
+
+    //Gradient of the weights of the whole batch
+    transposed_multiply_add(buffers.deltas, inputs, buffers.weight_gradients);
+}
+
+void layer::calculate_output_gradient(const byte_matrix& inputs, const matrix& expected_outputs,
+                                      layer_buffers& buffers) const {
+    calculate_batch_output_deltas(expected_outputs, buffers);
+
+    //Gradient of the weights of the whole batch, reading the bytes directly
+    transposed_multiply_add(buffers.deltas, inputs, input_scale, buffers.weight_gradients);
+}
+
+void layer::calculate_output_gradient(const sparse_matrix& inputs, const matrix& expected_outputs,
+                                      layer_buffers& buffers) const {
+    calculate_batch_output_deltas(expected_outputs, buffers);
+
+    //Gradient of the weights of the non zero inputs only
+    transposed_multiply_add(buffers.deltas, inputs, input_scale, buffers.weight_gradients);
+}
+
+void layer::calculate_hidden_gradient(const matrix& inputs, const layer& previous_layer,
+                                      const layer_buffers& previous_buffers, layer_buffers& buffers) const {
+    calculate_batch_hidden_deltas(previous_layer, previous_buffers, buffers);
+
+    //Gradient of the weights of the whole batch
+    transposed_multiply_add(buffers.deltas, inputs, buffers.weight_gradients);
+}
+
+void layer::calculate_hidden_gradient(const byte_matrix& inputs, const layer& previous_layer,
+                                      const layer_buffers& previous_buffers, layer_buffers& buffers) const {
+    calculate_batch_hidden_deltas(previous_layer, previous_buffers, buffers);
+
+    //Gradient of the weights of the whole batch, reading the bytes directly
+    transposed_multiply_add(buffers.deltas, inputs, input_scale, buffers.weight_gradients);
+}
+
+void layer::calculate_hidden_gradient(const sparse_matrix& inputs, const layer& previous_layer,
+                                      const layer_buffers& previous_buffers, layer_buffers& buffers) const {
+    calculate_batch_hidden_deltas(previous_layer, previous_buffers, buffers);
+
+    //Gradient of the weights of the non zero inputs only
+    transposed_multiply_add(buffers.deltas, inputs, input_scale, buffers.weight_gradients);
+}
+
+void layer::calculate_output_gradient(const matrix& inputs, const matrix& expected_outputs){
+    calculate_output_gradient(inputs, expected_outputs, buffers);
+}
+
+void layer::calculate_output_gradient(const byte_matrix& inputs, const matrix& expected_outputs){
+    calculate_output_gradient(inputs, expected_outputs, buffers);
+}
+
+void layer::calculate_output_gradient(const sparse_matrix& inputs, const matrix& expected_outputs){
+    calculate_output_gradient(inputs, expected_outputs, buffers);
+}
+
+void layer::calculate_hidden_gradient(const matrix& inputs, const layer& previous_layer){
+    calculate_hidden_gradient(inputs, previous_layer, previous_layer.buffers, buffers);
+}
+
+void layer::calculate_hidden_gradient(const byte_matrix& inputs, const layer& previous_layer){
+    calculate_hidden_gradient(inputs, previous_layer, previous_layer.buffers, buffers);
+}
+
+void layer::calculate_hidden_gradient(const sparse_matrix& inputs, const layer& previous_layer){
+    calculate_hidden_gradient(inputs, previous_layer, previous_layer.buffers, buffers);
+}
+
+void layer::update_weights(int batch_size, real learning_rate){
+    update_weights(buffers, batch_size, learning_rate);
+}
+
+void layer::update_weights(layer_buffers& gradients, int batch_size, real learning_rate){
+    const kernel_table& kernel = kernels();
+
+    for_nodes([&](int first, int last){
+        for(int i = first; i < last; i++){
+            //Update the bias
+            this->bias[i] -= learning_rate * (gradients.bias_gradients[i] / batch_size);
+            gradients.bias_gradients[i] = 0;
+
+            //Update the weights
+            kernel.update(weights.row(i).data(), gradients.weight_gradients.row(i).data(), inputs, learning_rate, batch_size);
+        }
+    });
 }
 
-void layer::update_weights(int batch_size, double learning_rate){
+void layer::update_weights(layer_buffers& gradients, int batch_size, real learning_rate, const sparse_matrix& inputs){
     for(int i = 0; i < nodes; i++){
         //Update the bias
-        this->bias[i] -= learning_rate * (this->bias_gradients[i] / batch_size);
-        this->bias_gradients[i] = 0;
+        this->bias[i] -= learning_rate * (gradients.bias_gradients[i] / batch_size);
+        gradients.bias_gradients[i] = 0;
+
+        //Update the weights of the non zero inputs (a repeated input finds its gradient already reset)
+        real* w = weights.row(i).data();
+        accumulator* g = gradients.weight_gradients.row(i).data();
+        for(long k = inputs.offsets[0]; k < inputs.offsets[inputs.rows]; k++){
+            int j = inputs.indices[k];
+            w[j] -= learning_rate * (g[j] / batch_size);
+            g[j] = 0;
+        }
+    }
+}
+
+void layer::update_weights(const vector<layer_buffers*>& gradients, int batch_size, real learning_rate,
+                           int first_node, int last_node){
+    const kernel_table& kernel = kernels();
+    const int workers = (int)gradients.size();
+
+    for(int i = first_node; i < last_node; i++){
+        //Pairwise tree sum of the row of every worker into the first one (the rows stay in L1)
+        for(int step = 1; step < workers; step *= 2)
+            for(int w = 0; w + step < workers; w += 2 * step){
+                kernel.merge(gradients[w + step]->weight_gradients.row(i).data(),
+                             gradients[w]->weight_gradients.row(i).data(), inputs);
+
+                gradients[w]->bias_gradients[i] += gradients[w + step]->bias_gradients[i];
+                gradients[w + step]->bias_gradients[i] = 0;
+            }
+
+        //Update the bias
+        this->bias[i] -= learning_rate * (gradients[0]->bias_gradients[i] / batch_size);
+        gradients[0]->bias_gradients[i] = 0;
 
         //Update the weights
-        for(int j = 0; j < inputs; j++) {
-            this->weights[i][j] -= learning_rate * (this->weight_gradients[i][j] / batch_size);
-            this->weight_gradients[i][j] = 0;
-        }
+        kernel.update(weights.row(i).data(), gradients[0]->weight_gradients.row(i).data(), inputs,
+                      learning_rate, batch_size);
     }
 }
 
 void layer::initialize_gradient() {
-    this->bias_gradients = vector<double>(this->nodes);
+    initialize_gradient(buffers);
+}
+
+void layer::initialize_gradient(layer_buffers& gradients) const {
+    gradients.bias_gradients = aligned_vector<accumulator>(this->nodes);
+    gradients.weight_gradients = gradient_matrix(this->nodes, this->inputs);
+}
+
+real* layer::save_parameters(real* parameters) const {
+    for(int i = 0; i < nodes; i++)
+        parameters = copy(weights.row(i).begin(), weights.row(i).end(), parameters);
+    return copy(bias.begin(), bias.end(), parameters);
+}
+
+const real* layer::load_parameters(const real* parameters) {
+    for(int i = 0; i < nodes; i++, parameters += inputs)
+        copy(parameters, parameters + inputs, weights.row(i).begin());
+    copy(parameters, parameters + nodes, bias.begin());
+    return parameters + nodes;
+}
+
+accumulator* layer::save_gradient(const layer_buffers& gradients, accumulator* flat) const {
+    for(int i = 0; i < nodes; i++)
+        flat = copy(gradients.weight_gradients.row(i).begin(), gradients.weight_gradients.row(i).end(), flat);
+    return copy(gradients.bias_gradients.begin(), gradients.bias_gradients.end(), flat);
+}
 
-    this->weight_gradients.resize(this->nodes);
-    for(vector<double>& node : weight_gradients)
-        node = vector<double>(inputs,0);
+const accumulator* layer::load_gradient(const accumulator* flat, layer_buffers& gradients) const {
+    for(int i = 0; i < nodes; i++, flat += inputs)
+        copy(flat, flat + inputs, gradients.weight_gradients.row(i).begin());
+    copy(flat, flat + nodes, gradients.bias_gradients.begin());
+    return flat + nodes;
 }
 
 void layer::free_gradient() {
-    this->bias_gradients = {};
-    this->weight_gradients = {};
+    buffers.bias_gradients = {};
+    buffers.weight_gradients.clear();
 }
 
-double layer::random_double() {
-    return (((double) rand()) / ((double) RAND_MAX) - 0.5) * 2;
+real layer::random_real() {
+    return (((real) rand()) / ((real) RAND_MAX) - (real)0.5) * 2;
 }
 
-double layer::node_cost(double output, double expected_output) {
+real layer::node_cost(real output, real expected_output) {
     //Mean squared error
-    double error = output - expected_output;
+    real error = output - expected_output;
     return error * error;
 }
 
-double layer::d_node_cost(double output, double expected_output) {
+real layer::d_node_cost(real output, real expected_output) {
     return 2 * (output - expected_output);
 }
 
@@ -232,10 +496,12 @@ layer& layer::operator=(const layer& other) {
         this->nodes = other.nodes;
         this->inputs = other.inputs;
         this->activation_function = other.activation_function;
+        this->input_scale = other.input_scale;
+        this->pool = other.pool;
+        this->parallel_threshold = other.parallel_threshold;
         this->outputs = other.outputs;
         this->deltas = other.deltas;
-        this->weight_gradients = other.weight_gradients;
-        this->bias_gradients = other.bias_gradients;
+        this->buffers = other.buffers;
     }
 
     return *this;
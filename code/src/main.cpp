@@ -2,19 +2,124 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <chrono>
 
 #include "n_network.h"
 #include "data_set.h"
+#include "shm_all_reduce.h"
+#include "parameter_server.h"
+#include "streaming_data_set.h"
 
 
 int main(int argc, char * argv[]) {
         
     srand((unsigned) time(NULL));
 
+    //Number of training threads (--threads N, 0 uses one per hardware thread)
+    int threads = 1;
+    for(int i = 1; i + 1 < argc; i++)
+        if(strcmp(argv[i], "--threads") == 0) threads = atoi(argv[i + 1]);
+
+    //Number of training processes (--world-size N), they sum their gradients through shared memory
+    int world_size = 1;
+    for(int i = 1; i + 1 < argc; i++)
+        if(strcmp(argv[i], "--world-size") == 0) world_size = max(1, atoi(argv[i + 1]));
+
+    //Number of asynchronous workers of a parameter server (--parameter-server N) and most
+    //batches a worker can get ahead of the slowest one (--staleness S)
+    int ps_workers = 0, staleness = 4;
+    for(int i = 1; i + 1 < argc; i++){
+        if(strcmp(argv[i], "--parameter-server") == 0) ps_workers = atoi(argv[i + 1]);
+        if(strcmp(argv[i], "--staleness") == 0) staleness = atoi(argv[i + 1]);
+    }
+
+    //Encoding of the gradients pushed by the workers (--compression none|fp16|bf16|topk|int8)
+    //and fraction of them sent by topk (--top-k R)
+    compression method = compression::none;
+    double top_k_ratio = 0.01;
+    for(int i = 1; i + 1 < argc; i++){
+        if(strcmp(argv[i], "--compression") == 0 && !parse_compression(argv[i + 1], method))
+            std::cerr << "Unknown compression: " << argv[i + 1] << ", using none" << std::endl;
+        if(strcmp(argv[i], "--top-k") == 0) top_k_ratio = atof(argv[i + 1]);
+    }
+
+    //Asynchronous lock-free training instead of synchronous batches (--hogwild), one thread
+    //per group of layers (--pipeline) or the same result for any number of threads (--deterministic)
+    bool hogwild = false, pipeline = false, deterministic = false;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--hogwild") == 0) hogwild = true;
+        if(strcmp(argv[i], "--pipeline") == 0) pipeline = true;
+        if(strcmp(argv[i], "--deterministic") == 0) deterministic = true;
+    }
+
+    //Batches loaded ahead by the background loader of learn (--prefetch D, 0 loads on the training threads)
+    int prefetch = 2;
+    for(int i = 1; i + 1 < argc; i++)
+        if(strcmp(argv[i], "--prefetch") == 0) prefetch = atoi(argv[i + 1]);
+
+    //Visit the samples in a new order every epoch, shuffled by blocks (--shuffle SEED)
+    bool shuffle = false;
+    unsigned shuffle_seed = 1;
+    for(int i = 1; i + 1 < argc; i++)
+        if(strcmp(argv[i], "--shuffle") == 0){
+            shuffle = true;
+            shuffle_seed = (unsigned)atoi(argv[i + 1]);
+        }
+
+    //Random shifts, rotations and elastic distortion of the training images (--augment),
+    //transformed by N loader threads (--loaders N)
+    augmentation augment;
+    int loaders = 1;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--augment") == 0){
+            augment.max_shift = 2;
+            augment.max_rotation = 0.15;
+            augment.elastic_alpha = 34;
+        }
+        if(strcmp(argv[i], "--loaders") == 0 && i + 1 < argc) loaders = atoi(argv[i + 1]);
+    }
+
+    std::cout << "Precision: " << sizeof(real) * 8 << " bit weights, "
+              << sizeof(accumulator) * 8 << " bit accumulation" << std::endl;
+
+    //Read the samples straight from the mapped files instead of copying them (--mmap),
+    //from a preprocessed cache next to them, built on the first run (--cache),
+    //or keep only their non zero pixels in memory, decoded into every batch (--compress)
+    dataset_storage storage = dataset_storage::owning;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--mmap") == 0) storage = dataset_storage::mapped;
+        if(strcmp(argv[i], "--cache") == 0) storage = dataset_storage::cached;
+        if(strcmp(argv[i], "--compress") == 0) storage = dataset_storage::compressed;
+    }
+
+    //Stream the training set from disk keeping at most this many MB of samples in memory (--stream MB)
+    double stream_budget = 0;
+    for(int i = 1; i + 1 < argc; i++)
+        if(strcmp(argv[i], "--stream") == 0) stream_budget = atof(argv[i + 1]);
+
+    //Read the streamed files with ifstream, pread or io_uring (--io stream|pread|uring),
+    //bypassing the page cache (--direct)
+    io_backend backend = io_backend::stream;
+    bool direct = false;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--io") == 0 && i + 1 < argc && !parse_io_backend(argv[i + 1], backend)){
+            std::cerr << "Unknown I/O backend: " << argv[i + 1] << std::endl;
+            return 1;
+        }
+        if(strcmp(argv[i], "--direct") == 0) direct = true;
+    }
+
     //Open the dataset
     string data_path = "../../data/train-images.idx3-ubyte";
     string label_path = "../../data/train-labels.idx1-ubyte";
-    data_set d(data_path, label_path);
+    auto open_start = chrono::steady_clock::now();
+    data_set d = stream_budget > 0 ? data_set(nullptr, nullptr, 0, 0) : data_set(data_path, label_path, storage);
+    std::cout << "Opening time: " << chrono::duration<double>(chrono::steady_clock::now() - open_start).count()
+              << " s" << std::endl;
+    std::cout << "Samples in memory: " << (double)d.memory_size() / (1 << 20) << " MB" << std::endl;
+
+    //Keep only the non zero pixels too, most of each image is background
+    if(stream_budget == 0) d.build_sparse();
 
     std::cout<<std::endl;
 
@@ -23,6 +128,12 @@ int main(int argc, char * argv[]) {
                       sig_activation, sig_activation);
     network.set_layer_nodes(0,32);
     network.set_layer_nodes(1,16);
+    network.set_input_scale(d.scale()); //Pixels of the cache are scaled to [0, 1]
+    network.set_threads(threads);
+    network.set_deterministic(deterministic);
+    network.set_prefetch(prefetch, loaders);
+    network.set_augmentation(augment);
+    network.set_shuffle(shuffle, shuffle_seed);
 
     //Initialize the hyperparameters
     int batch_size = 10;
@@ -30,7 +141,31 @@ int main(int argc, char * argv[]) {
     int epochs = 10;
 
     //Train the network
-    network.learn(d, batch_size, learning_rate, epochs);
+    auto start = chrono::steady_clock::now();
+    if(stream_budget > 0){
+        streaming_data_set stream(data_path, label_path, (size_t)(stream_budget * (1 << 20)), 0, 1, backend, direct);
+        std::cout << "I/O backend: " << io_backend_name(stream.get_backend()) << std::endl;
+        network.learn(stream, batch_size, learning_rate, epochs);
+    }
+    else if(world_size > 1){
+        //Every process starts from the same network and dataset, only rank 0 goes on to the test
+        shm_all_reduce group(world_size, network.gradient_size());
+        int rank = group.fork_ranks();
+        network.learn_distributed(d, batch_size, learning_rate, epochs, group);
+        if(rank != 0) return 0;
+    }
+    else if(ps_workers > 0){
+        //The server (rank 0) keeps the trained weights and goes on to the test
+        parameter_server group(ps_workers, staleness, method, top_k_ratio);
+        int rank = group.fork_workers();
+        network.learn_parameter_server(d, batch_size, learning_rate, epochs, group);
+        if(rank != 0) return 0;
+    }
+    else if(hogwild) network.learn_hogwild(d, batch_size, learning_rate, epochs);
+    else if(pipeline) network.learn_pipeline(d, batch_size, learning_rate, epochs);
+    else network.learn(d, batch_size, learning_rate, epochs);
+    std::cout << "Training time: " << chrono::duration<double>(chrono::steady_clock::now() - start).count()
+              << " s" << std::endl;
 
     //Close the dataset
     d.close();
@@ -38,13 +173,16 @@ int main(int argc, char * argv[]) {
     //Open the test dataset with the test images
     data_path = "../../data/t10k-images.idx3-ubyte";
     label_path = "../../data/t10k-labels.idx1-ubyte";
-    d.open(data_path, label_path);
+    d.open(data_path, label_path, storage);
 
     //Test the network
     int total_hits = 0;
+    inference_workspace workspace;
+    vector<unsigned char> pixels(d.sample_size());
     for(int i = 0; i < 100; i++) {
-        //Calculate the output of the network (Forward pass)
-        auto aux = network.calculate_outputs(d.data[i]);
+        //Calculate the output of the network (Forward pass, no allocations)
+        d.copy_sample(i, pixels.data());
+        auto aux = network.calculate_outputs(pixels, workspace);
 
         //Get the maximum value of the output (the predicted label)
         double max = 0;
@@ -57,14 +195,14 @@ int main(int argc, char * argv[]) {
         }
         
         //Check if the predicted label is correct
-        if(max_pos == d.labels[i]) total_hits++;
+        if(max_pos == d.label(i)) total_hits++;
     }
 
     d.close();
 
     //Show the results
     std::cout<<std::endl;
-    std::cout<<"The total cost is: " <<network.cost(d, 0, d.data.size());
+    std::cout<<"The total cost is: " <<network.cost(d, 0, d.size());
     std::cout<<std::endl;
     std::cout<<"Total accuracy: "<< total_hits << "%";
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "matrix.h"
+#include "kernels.h"
+
+//Tile size: a block of rows of a and b (ROW_BLOCK rows each) is reused from L2
+static const int ROW_BLOCK = 64;
+//Columns of c updated together by transposed_multiply_add (kept in L1)
+static const int COL_BLOCK = 256;
+
+/**
+ * @brief Cache tiled c = f(a * b^T + bias), block(pa, sa, pb, sb, pc, sc, rows, cols, k) does the dot products
+ */
+template <class A, class Block>
+static void tiled_multiply_transposed(const basic_matrix<A>& a, const matrix& b, matrix& c,
+                                      const real* bias, real (*function)(real), Block block){
+    const int rows = a.get_rows(), cols = b.get_rows(), k = a.get_cols();
+
+    if(c.get_rows() != rows || c.get_cols() != cols)
+        c = matrix(rows, cols);
+
+    const int sa = a.get_stride(), sb = b.get_stride(), sc = c.get_stride();
+
+    for(int r0 = 0; r0 < rows; r0 += ROW_BLOCK){
+        const int r1 = min(r0 + ROW_BLOCK, rows);
+
+        for(int c0 = 0; c0 < cols; c0 += ROW_BLOCK){
+            const int c1 = min(c0 + ROW_BLOCK, cols);
+
+            //Start every element from the bias
+            for(int r = r0; r < r1; r++)
+                for(int j = c0; j < c1; j++)
+                    c(r, j) = bias ? bias[j] : 0;
+
+            //Register tiled dot products of the block
+            block(a.data() + (size_t)r0 * sa, sa, b.data() + (size_t)c0 * sb, sb,
+                  c.data() + (size_t)r0 * sc + c0, sc, r1 - r0, c1 - c0, k);
+
+            //The tile is final and still in cache: apply the function
+            if(function)
+                for(int r = r0; r < r1; r++)
+                    for(int j = c0; j < c1; j++)
+                        c(r, j) = function(c(r, j));
+        }
+    }
+}
+
+void multiply_transposed(const matrix& a, const matrix& b, matrix& c,
+                         const real* bias, real (*function)(real)){
+    const kernel_table& kernel = kernels();
+
+    tiled_multiply_transposed(a, b, c, bias, function,
+        [&](const real* pa, int sa, const real* pb, int sb, real* pc, int sc, int rows, int cols, int k){
+            kernel.dot_block(pa, sa, pb, sb, pc, sc, rows, cols, k);
+        });
+}
+
+void multiply_transposed(const byte_matrix& a, real scale, const matrix& b, matrix& c,
+                         const real* bias, real (*function)(real)){
+    const kernel_table& kernel = kernels();
+
+    tiled_multiply_transposed(a, b, c, bias, function,
+        [&](const unsigned char* pa, int sa, const real* pb, int sb, real* pc, int sc, int rows, int cols, int k){
+            kernel.dot_block_bytes(pa, sa, scale, pb, sb, pc, sc, rows, cols, k);
+        });
+}
+
+void multiply(const matrix& a, const matrix& b, matrix& c){
+    const int rows = a.get_rows(), cols = b.get_cols(), k = a.get_cols();
+    const kernel_table& kernel = kernels();
+
+    if(c.get_rows() != rows || c.get_cols() != cols)
+        c = matrix(rows, cols);
+
+    for(int r0 = 0; r0 < rows; r0 += 4){
+        const int r1 = min(r0 + 4, rows);
+
+        for(int r = r0; r < r1; r++)
+            fill(c.row(r).begin(), c.row(r).end(), 0);
+
+        //Each row of b is loaded once for 4 rows of c
+        for(int i = 0; i < k; i++){
+            const real* pb = b.row(i).data();
+            for(int r = r0; r < r1; r++)
+                kernel.axpy(a(r, i), pb, c.row(r).data(), cols);
+        }
+    }
+}
+
+void transposed_multiply(const matrix& a, array_view<const real> x, array_view<real> y){
+    const kernel_table& kernel = kernels();
+
+    fill(y.begin(), y.end(), 0);
+
+    //y is a weighted sum of the rows of a, so a is read contiguously
+    for(int i = 0; i < a.get_rows(); i++)
+        kernel.axpy(x[i], a.row(i).data(), y.data(), a.get_cols());
+}
+
+/**
+ * @brief Cache tiled c += a^T * b, row(factor, pb, pc, n) adds factor * pb to pc
+ */
+template <class B, class Row>
+static void tiled_transposed_multiply_add(const matrix& a, const basic_matrix<B>& b, gradient_matrix& c, Row row){
+    const int rows = a.get_cols(), cols = b.get_cols(), k = a.get_rows();
+
+    //Block of c small enough to stay in L1 while every rank-1 update is added
+    const int C_ROWS = 8, C_COLS = COL_BLOCK;
+
+    for(int r0 = 0; r0 < rows; r0 += C_ROWS){
+        const int r1 = min(r0 + C_ROWS, rows);
+
+        for(int c0 = 0; c0 < cols; c0 += C_COLS){
+            const int c1 = min(c0 + C_COLS, cols);
+
+            for(int i = 0; i < k; i++){
+                const B* pb = b.row(i).data();
+                for(int r = r0; r < r1; r++)
+                    row(a(i, r), pb + c0, c.row(r).data() + c0, c1 - c0);
+            }
+        }
+    }
+}
+
+void transposed_multiply_add(const matrix& a, const matrix& b, gradient_matrix& c){
+    const kernel_table& kernel = kernels();
+
+    tiled_transposed_multiply_add(a, b, c, [&](real factor, const real* pb, accumulator* pc, int n){
+        kernel.accumulate(factor, pb, pc, n);
+    });
+}
+
+void transposed_multiply_add(const matrix& a, const byte_matrix& b, real scale, gradient_matrix& c){
+    const kernel_table& kernel = kernels();
+
+    tiled_transposed_multiply_add(a, b, c, [&](real factor, const unsigned char* pb, accumulator* pc, int n){
+        kernel.accumulate_bytes(factor, pb, scale, pc, n);
+    });
+}
+
+void multiply_transposed(const sparse_matrix& a, real scale, const matrix& b, matrix& c,
+                         const real* bias, real (*function)(real)){
+    const int rows = a.get_rows(), cols = b.get_rows();
+
+    if(c.get_rows() != rows || c.get_cols() != cols)
+        c = matrix(rows, cols);
+
+    for(int r = 0; r < rows; r++){
+        const sparse_vector x = a.row(r);
+        real* pc = c.row(r).data();
+
+        //Gather the weights of the non zero inputs only
+        for(int j = 0; j < cols; j++){
+            const real* pb = b.row(j).data();
+            accumulator sum = bias ? bias[j] : 0;
+            for(int i = 0; i < x.count; i++)
+                sum += (accumulator)x.values[i] * scale * pb[x.indices[i]];
+            pc[j] = function ? function((real)sum) : (real)sum;
+        }
+    }
+}
+
+void transposed_multiply_add(const matrix& a, const sparse_matrix& b, real scale, gradient_matrix& c){
+    const int rows = a.get_cols();
+
+    //Scatter each sample into the columns of its non zero inputs, samples in order
+    for(int s = 0; s < b.get_rows(); s++){
+        const sparse_vector x = b.row(s);
+        for(int r = 0; r < rows; r++){
+            const accumulator factor = a(s, r);
+            accumulator* pc = c.row(r).data();
+            for(int i = 0; i < x.count; i++)
+                pc[x.indices[i]] += factor * ((accumulator)x.values[i] * scale);
+        }
+    }
+}
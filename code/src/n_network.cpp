@@ -1,6 +1,33 @@
 #include "n_network.h"
+#include "kernels.h"
+#include "thread_pool.h"
+#include "spsc_queue.h"
+#include "shm_all_reduce.h"
+#include "parameter_server.h"
+#include "streaming_data_set.h"
+#include "augmentation.h"
+#include "batch_loader.h"
+#include "epoch_sampler.h"
+#include <memory>
+#include <stdexcept>
 #include <iostream>
 
+//Samples per forward pass when computing the cost of a dataset
+static const int COST_BATCH = 256;
+
+/**
+ * @brief Highest input density for which the sparse path is faster than the dense kernels
+ * @details Measured on 784 input MNIST-like batches: the wider the vectors of the dense
+ * kernels, the fewer non zero inputs are needed for the gather/scatter to pay off
+ */
+static double default_sparse_threshold(){
+    switch(kernels().type){
+        case isa::scalar: return 0.4;
+        case isa::sse2: return 0.25;
+        default: return 0.12;
+    }
+}
+
 
 n_network::n_network(int num_layers, int num_inputs, int num_outputs,
                      const activation& hidden_activation,
@@ -9,6 +36,15 @@ n_network::n_network(int num_layers, int num_inputs, int num_outputs,
     this->num_layers = num_layers;
     this->num_inputs = num_inputs;
     this->num_outputs = num_outputs;
+    this->sparse_threshold = -1;
+    this->threads = 1;
+    this->deterministic_chunk = 0;
+    this->prefetch_depth = 2;
+    this->prefetch_threads = 1;
+    this->shuffle_block = 0;
+    this->shuffle_window = 1;
+    this->shuffle_seed = 1;
+    this->augment_seed = 1;
 
    int i = 0;
 
@@ -22,6 +58,19 @@ n_network::n_network(int num_layers, int num_inputs, int num_outputs,
 }
 
 
+double n_network::get_sparse_threshold() const {
+    return sparse_threshold < 0 ? default_sparse_threshold() : sparse_threshold;
+}
+
+void n_network::set_thread_pool(thread_pool* pool, long threshold) {
+    for(layer& l : layers)
+        l.set_thread_pool(pool, threshold);
+}
+
+void n_network::set_input_scale(real scale) {
+    layers[0].set_input_scale(scale);
+}
+
 void n_network::set_hidden_function(const activation& new_activation) {
     for(int i = 0; i < num_layers - 1; i++)
         layers[i].set_activation_function(new_activation);
@@ -82,21 +131,60 @@ void n_network::free_gradients() {
         l.free_gradient();
 }
 
-vector<double> n_network::calculate_outputs(const vector<unsigned char>& input){
-    vector<double> result;
-    //Forward pass
-    result = layers[0].calculate_outputs(input);
+vector<real> n_network::calculate_outputs(const vector<unsigned char>& input){
+    //Forward pass, each layer reads the outputs of the previous one in place
+    array_view<const real> result = layers[0].calculate_outputs(input);
     for(int i = 1; i < num_layers; i++)
         result = layers[i].calculate_outputs(result);
 
-    return result;
+    return vector<real>(result.begin(), result.end());
+}
+template <class Inputs>
+const matrix& n_network::batch_outputs(const Inputs& inputs){
+    //Forward pass, one matrix product per layer
+    const matrix* result = &layers[0].calculate_outputs(inputs);
+    for(int i = 1; i < num_layers; i++)
+        result = &layers[i].calculate_outputs(*result);
+
+    return *result;
+}
+
+const matrix& n_network::calculate_outputs(const matrix& inputs){
+    return batch_outputs(inputs);
+}
+
+const matrix& n_network::calculate_outputs(const byte_matrix& inputs){
+    return batch_outputs(inputs);
+}
+
+const matrix& n_network::calculate_outputs(const sparse_matrix& inputs){
+    return batch_outputs(inputs);
 }
-double n_network::cost(const vector<unsigned char>& input,
-                       const vector<double>& expected_output){
-    double cost = 0;
+void n_network::prepare_workspace(inference_workspace& workspace) const {
+    //resize keeps the capacity, so this only allocates when the network grows
+    workspace.outputs.resize(num_layers);
+    for(int i = 0; i < num_layers; i++)
+        workspace.outputs[i].resize(layers[i].get_nodes());
+}
+
+array_view<const real> n_network::calculate_outputs(array_view<const unsigned char> input,
+                                                    inference_workspace& workspace) const {
+    prepare_workspace(workspace);
+
+    //Forward pass, each layer writes its outputs in the workspace (the bytes are read directly)
+    layers[0].calculate_outputs(input, workspace.outputs[0]);
+    for(int i = 1; i < num_layers; i++)
+        layers[i].calculate_outputs(workspace.outputs[i - 1], workspace.outputs[i]);
+
+    return workspace.outputs.back();
+}
+
+accumulator n_network::cost(const vector<unsigned char>& input,
+                            const vector<real>& expected_output){
+    accumulator cost = 0;
 
     //Forward pass
-    vector<double> outputs = calculate_outputs(input);
+    vector<real> outputs = calculate_outputs(input);
 
     //Calculate cost
     for(int i = 0; i < num_outputs; i++)
@@ -104,22 +192,58 @@ double n_network::cost(const vector<unsigned char>& input,
 
     return cost;
 }
-double n_network::cost(const data_set& dataset, int start_pos, int batch_size){
-    double total_cost = 0;
+accumulator n_network::cost(const matrix& inputs, const matrix& expected_outputs){
+    accumulator total_cost = 0;
+
+    //Forward pass of the whole batch
+    const matrix& outputs = calculate_outputs(inputs);
+
+    //Calculate cost of each sample
+    for(int s = 0; s < outputs.get_rows(); s++){
+        accumulator cost = 0;
+        for(int i = 0; i < num_outputs; i++)
+            cost += layer::node_cost(outputs(s, i), expected_outputs(s, i));
+        total_cost += cost;
+    }
 
-    //For each element in the dataset calculate the cost
-    for(int i = 0; i < batch_size; i++) {
-        vector<double> aux(num_outputs, 0);
-        aux[dataset.labels[i + start_pos]] = 1;
+    return total_cost;
+}
+bool n_network::use_sparse(const data_set& dataset, int start_pos, int batch_size) const {
+    return dataset.has_sparse() && dataset.sparse_batch(start_pos, batch_size).density() <= get_sparse_threshold();
+}
 
-        total_cost += cost(dataset.data[i + start_pos], aux);
+accumulator n_network::cost(const data_set& dataset, int start_pos, int batch_size){
+    accumulator total_cost = 0;
+    byte_matrix inputs;
+
+    //Calculate the cost a chunk of the dataset at a time
+    for(int i = 0; i < batch_size; i += COST_BATCH) {
+        int size = min(COST_BATCH, batch_size - i);
+
+        //Forward pass of the chunk, skipping the zero inputs if there are few non zero ones
+        const matrix* outputs_ptr;
+        if(use_sparse(dataset, start_pos + i, size))
+            outputs_ptr = &calculate_outputs(dataset.sparse_batch(start_pos + i, size));
+        else{
+            dataset.load_batch(start_pos + i, size, inputs);
+            outputs_ptr = &calculate_outputs(inputs);
+        }
+        const matrix& outputs = *outputs_ptr;
+
+        //Add the cost of each sample
+        for(int s = 0; s < size; s++){
+            accumulator cost = 0;
+            for(int j = 0; j < num_outputs; j++)
+                cost += layer::node_cost(outputs(s, j), j == dataset.label(start_pos + i + s) ? 1 : 0);
+            total_cost += cost;
+        }
     }
 
     //Return the average cost
     return total_cost / batch_size;
 }
 
-void n_network::calculate_gradient(const vector<unsigned char>& input, const vector<double>& expected_output){
+void n_network::calculate_gradient(const vector<unsigned char>& input, const vector<real>& expected_output){
     //Forward pass
     calculate_outputs(input);
 
@@ -133,44 +257,546 @@ void n_network::calculate_gradient(const vector<unsigned char>& input, const vec
     //Calculate gradients of first layer
     layers[0].calculate_hidden_gradient(input, layers[1]);
 }
-void n_network::update_weights(int batch_size, double learning_rate) {
+template <class Inputs>
+void n_network::batch_gradient(const Inputs& inputs, const matrix& expected_outputs){
+    //Forward pass
+    batch_outputs(inputs);
+
+    //Calculate gradients from the last layer to the first, each layer reads the outputs of the one before
+    for(int i = num_layers - 1; i >= 0; i--){
+        if(i == num_layers - 1 && i > 0)
+            layers[i].calculate_output_gradient(layers[i - 1].get_batch_outputs(), expected_outputs);
+        else if(i == num_layers - 1)
+            layers[i].calculate_output_gradient(inputs, expected_outputs);
+        else if(i > 0)
+            layers[i].calculate_hidden_gradient(layers[i - 1].get_batch_outputs(), layers[i + 1]);
+        else
+            layers[i].calculate_hidden_gradient(inputs, layers[i + 1]);
+    }
+}
+
+void n_network::calculate_gradient(const matrix& inputs, const matrix& expected_outputs){
+    batch_gradient(inputs, expected_outputs);
+}
+
+void n_network::calculate_gradient(const byte_matrix& inputs, const matrix& expected_outputs){
+    batch_gradient(inputs, expected_outputs);
+}
+
+void n_network::calculate_gradient(const sparse_matrix& inputs, const matrix& expected_outputs){
+    batch_gradient(inputs, expected_outputs);
+}
+template <class Inputs>
+void n_network::batch_gradient(const Inputs& inputs, const matrix& expected_outputs,
+                               vector<layer_buffers>& buffers) const {
+    //Forward pass
+    const matrix* result = &layers[0].calculate_outputs(inputs, buffers[0]);
+    for(int i = 1; i < num_layers; i++)
+        result = &layers[i].calculate_outputs(*result, buffers[i]);
+
+    //Same as the other batch_gradient, with the buffers of the caller
+    for(int i = num_layers - 1; i >= 0; i--){
+        if(i == num_layers - 1 && i > 0)
+            layers[i].calculate_output_gradient(buffers[i - 1].outputs, expected_outputs, buffers[i]);
+        else if(i == num_layers - 1)
+            layers[i].calculate_output_gradient(inputs, expected_outputs, buffers[i]);
+        else if(i > 0)
+            layers[i].calculate_hidden_gradient(buffers[i - 1].outputs, layers[i + 1], buffers[i + 1], buffers[i]);
+        else
+            layers[i].calculate_hidden_gradient(inputs, layers[i + 1], buffers[i + 1], buffers[i]);
+    }
+}
+
+void n_network::load_expected(const data_set& dataset, int start_pos, int size, matrix& expected) const {
+    dataset.load_one_hot(start_pos, size, num_outputs, expected);
+}
+
+void n_network::prepare_buffers(training_buffers& buffers) const {
+    buffers.layers.resize(num_layers);
+    for(int i = 0; i < num_layers; i++)
+        layers[i].initialize_gradient(buffers.layers[i]);
+}
+
+void n_network::calculate_gradient(const data_set& dataset, int start_pos, int size, training_buffers& buffers,
+                                   const int* order, const augmenter* augment, unsigned long long round) const {
+    //Shuffled samples are gathered from wherever they are
+    const int* indices = order != nullptr ? order + start_pos : nullptr;
+    if(indices != nullptr) dataset.load_one_hot(indices, size, num_outputs, buffers.expected);
+    else load_expected(dataset, start_pos, size, buffers.expected);
+
+    //Add the gradients of the samples, skipping the zero inputs if there are few non zero ones
+    //(transformed samples are always dense)
+    sparse_matrix sparse_inputs{};
+    bool sparse = augment == nullptr && dataset.has_sparse();
+    if(sparse)
+        sparse_inputs = indices != nullptr ? dataset.sparse_batch(indices, size, buffers.sparse)
+                                           : dataset.sparse_batch(start_pos, size);
+    if(sparse && sparse_inputs.density() <= get_sparse_threshold())
+        batch_gradient(sparse_inputs, buffers.expected, buffers.layers);
+    else{
+        if(indices != nullptr) dataset.load_batch(indices, size, buffers.inputs);
+        else dataset.load_batch(start_pos, size, buffers.inputs);
+        if(augment != nullptr) augment->apply(buffers.inputs, round, start_pos, buffers.augment);
+        batch_gradient(buffers.inputs, buffers.expected, buffers.layers);
+    }
+}
+
+void n_network::update_weights(int batch_size, real learning_rate) {
     //Update weights of each layer
     for(layer& l : layers)
         l.update_weights(batch_size, learning_rate);
 }
 
-void n_network::learn(const data_set& dataset, int batch_size, double learning_rate, int epochs){
-    //Initialize gradients
-    this->initialize_gradients();
+/**
+ * @brief A whole dataset as a single window (see n_network::learn_windows)
+ */
+struct whole_data_set {
+    const data_set& dataset; //*< Dataset */
+    bool done; //*< Set once the dataset has been given in this epoch */
+
+    void rewind() {done = false;};
+    const data_set* next() {
+        if(done) return nullptr;
+        done = true;
+        return &dataset;
+    };
+};
+
+void n_network::learn(const data_set& dataset, int batch_size, real learning_rate, int epochs){
+    whole_data_set windows{dataset, false};
+    learn_windows(windows, batch_size, learning_rate, epochs);
+}
+
+void n_network::learn(streaming_data_set& dataset, int batch_size, real learning_rate, int epochs){
+    learn_windows(dataset, batch_size, learning_rate, epochs);
+}
+
+template <class Windows>
+void n_network::learn_windows(Windows& windows, int batch_size, real learning_rate, int epochs){
+    //Print initial cost (of the first window)
+    windows.rewind();
+    const data_set* dataset = windows.next();
+    if(dataset == nullptr) return;
+    std::cout << "Initial cost: "<< cost(*dataset, 0, min(100, dataset->size())) << std::endl;
+
+    thread_pool pool(threads);
+    const int workers = pool.size();
+
+    //Slices of each batch: one per thread, or chunks of a fixed size that do not depend on the threads
+    const int slices = deterministic_chunk > 0 ? (batch_size + deterministic_chunk - 1) / deterministic_chunk : workers;
+
+    //Buffers of each slice
+    vector<training_buffers> buffers(slices);
+    for(training_buffers& b : buffers)
+        prepare_buffers(b);
+
+    //Gradients of each layer, one per slice (summed in the same order whatever thread computed them)
+    vector<vector<layer_buffers*>> gradients(num_layers);
+    for(int l = 0; l < num_layers; l++)
+        for(training_buffers& b : buffers)
+            gradients[l].push_back(&b.layers[l]);
+
+    //Order of the samples of each window (shuffled by blocks, see set_shuffle)
+    epoch_sampler sampler(shuffle_block, shuffle_window, shuffle_seed);
+    if(shuffle_block > 0) sampler.reserve(dataset->size());
+
+    //Random transforms of the samples (see set_augmentation)
+    unique_ptr<augmenter> augment;
+    if(augment_settings.enabled()){
+        if(augment_settings.rows * augment_settings.cols != dataset->sample_size())
+            throw runtime_error("The augmented images do not match the size of the samples");
+        augment = make_unique<augmenter>(augment_settings, augment_seed);
+    }
+
+    //Next batches gathered in the background while the current one trains, restarted on every window
+    unique_ptr<batch_loader> loader;
+    if(prefetch_depth > 0)
+        loader = make_unique<batch_loader>(num_outputs, batch_size, slices, deterministic_chunk, get_sparse_threshold(),
+                                           prefetch_depth, prefetch_threads, augment.get());
+
+    //For each epoch
+    for(int epoch = 0; epoch < epochs; epoch++){
+        const data_set* last_window = dataset;
+        unsigned window = 0;
+
+        //For each window of the epoch
+        for(windows.rewind(); (dataset = windows.next()) != nullptr; last_window = dataset, window++){
+            const int* order = shuffle_block > 0 ? sampler.shuffle(dataset->size(), epoch, window) : nullptr;
+            const unsigned long long round = (unsigned long long)epoch << 32 | window;
+
+            if(loader) loader->restart(*dataset, order, round);
+
+            //For each batch in the window
+            for(int i = 0; i < dataset->size(); i += batch_size){
+                int size = min(batch_size, dataset->size() - i);
+                const prepared_batch* batch = loader ? &loader->next() : nullptr;
+
+                //Each thread adds the gradients of its slices of the batch to their buffers
+                pool.run([&](int t){
+                    for(int s = t; s < slices; s += workers){
+                        if(batch == nullptr){
+                            int first, last;
+                            batch_loader::slice(i, size, s, slices, deterministic_chunk, first, last);
+                            if(first < last) calculate_gradient(*dataset, first, last - first, buffers[s], order, augment.get(), round);
+                        }
+                        else if(batch->slices[s].size > 0){
+                            const prepared_slice& slice = batch->slices[s];
+                            if(slice.sparse)
+                                batch_gradient(slice.sparse_inputs, slice.expected, buffers[s].layers);
+                            else
+                                batch_gradient(slice.inputs, slice.expected, buffers[s].layers);
+                        }
+                    }
+                });
+
+                //The loader can reuse the slot while the weights are updated
+                if(loader) loader->release();
+
+                //Each thread sums the gradients of a slice of the nodes of every layer and updates them
+                pool.run([&](int t){
+                    for(int l = 0; l < num_layers; l++){
+                        int nodes = layers[l].get_nodes();
+                        layers[l].update_weights(gradients[l], size, learning_rate,
+                                                 nodes * t / workers, nodes * (t + 1) / workers);
+                    }
+                });
+            }
+        }
+
+        //Print the updated cost (of the last window)
+        std::cout << "Cost for epoch " << epoch << ": " << cost(*last_window, 0, min(100, last_window->size())) << std::endl;
+    }
+}
+
+
+size_t n_network::gradient_size() const{
+    size_t size = 0;
+    for(const layer& l : layers)
+        size += (size_t)l.get_nodes() * (l.get_inputs() + 1);
+    return size;
+}
+
+
+void n_network::get_parameters(array_view<real> parameters) const{
+    real* p = parameters.data();
+    for(const layer& l : layers)
+        p = l.save_parameters(p);
+}
+
+
+void n_network::set_parameters(array_view<const real> parameters){
+    const real* p = parameters.data();
+    for(layer& l : layers)
+        p = l.load_parameters(p);
+}
+
+
+void n_network::save_gradient(const training_buffers& buffers, array_view<accumulator> gradients) const{
+    accumulator* g = gradients.data();
+    for(int l = 0; l < num_layers; l++)
+        g = layers[l].save_gradient(buffers.layers[l], g);
+}
+
+
+void n_network::load_gradient(array_view<const accumulator> gradients, training_buffers& buffers) const{
+    const accumulator* g = gradients.data();
+    for(int l = 0; l < num_layers; l++)
+        g = layers[l].load_gradient(g, buffers.layers[l]);
+}
+
+
+void n_network::learn_distributed(const data_set& dataset, int batch_size, real learning_rate, int epochs,
+                                  shm_all_reduce& group){
+    const int rank = group.get_rank(), world_size = group.get_world_size();
 
     //Print initial cost
+    if(rank == 0) std::cout << "Initial cost: "<< cost(dataset,0,100) << std::endl;
+
+    training_buffers buffers;
+    prepare_buffers(buffers);
+
+    array_view<accumulator> shared = group.buffer();
+    if(shared.size() != (int)gradient_size())
+        throw runtime_error("The all-reduce group does not match the gradients of the network");
+
+    //A process that fails stops the others instead of leaving them waiting in the barriers
+    try{
+        //For each epoch
+        for(int epoch = 0; epoch < epochs; epoch++){
+
+            //For each batch in the dataset
+            for(int i = 0; i < dataset.size(); i += batch_size){
+                int size = min(batch_size, dataset.size() - i);
+
+                //Gradient of the shard of this process
+                int first = i + size * rank / world_size;
+                int last = i + size * (rank + 1) / world_size;
+                if(first < last) calculate_gradient(dataset, first, last - first, buffers);
+
+                //Sum of the gradients of every process
+                save_gradient(buffers, shared);
+                group.all_reduce();
+                load_gradient(shared, buffers);
+
+                //Every process applies the same update
+                for(int l = 0; l < num_layers; l++)
+                    layers[l].update_weights(buffers.layers[l], size, learning_rate);
+            }
+
+            //Print the updated cost
+            if(rank == 0) std::cout << "Cost for epoch " << epoch << ": " << cost(dataset,0,100) << std::endl;
+        }
+    }
+    catch(...){
+        group.abort();
+        throw;
+    }
+}
+
+
+void n_network::learn_parameter_server(const data_set& dataset, int batch_size, real learning_rate, int epochs,
+                                       parameter_server& group){
+    const int rank = group.get_rank(), workers = group.get_workers();
+    const int samples = dataset.size();
+
+    training_buffers buffers;
+    prepare_buffers(buffers);
+
+    aligned_vector<real> parameters(gradient_size());
+    aligned_vector<accumulator> gradients(gradient_size());
+
+    if(rank > 0){
+        //Worker: every batch of its shard with the latest weights it is allowed to see
+        int first = (int)((long)samples * (rank - 1) / workers);
+        int last = (int)((long)samples * rank / workers);
+
+        group.pull(parameters);
+        for(int epoch = 0; epoch < epochs; epoch++)
+            for(int i = first; i < last; i += batch_size){
+                int size = min(batch_size, last - i);
+                set_parameters(parameters);
+
+                calculate_gradient(dataset, i, size, buffers);
+                save_gradient(buffers, gradients);
+                for(layer_buffers& b : buffers.layers){
+                    b.weight_gradients.fill(0);
+                    fill(b.bias_gradients.begin(), b.bias_gradients.end(), 0);
+                }
+
+                group.push(gradients, size);
+                group.pull(parameters);
+            }
+
+        group.finish();
+        return;
+    }
+
+    //Server: apply the gradients in the order they arrive
     std::cout << "Initial cost: "<< cost(dataset,0,100) << std::endl;
 
+    long batches_per_epoch = 0;
+    for(int w = 0; w < workers; w++){
+        long shard = (long)samples * (w + 1) / workers - (long)samples * w / workers;
+        batches_per_epoch += (shard + batch_size - 1) / batch_size;
+    }
+
+    long version = 0;
+    get_parameters(parameters);
+    group.release(parameters, version);
+
+    int size;
+    while(group.receive(gradients, size) > 0){
+        if(size > 0){
+            load_gradient(gradients, buffers);
+            for(int l = 0; l < num_layers; l++)
+                layers[l].update_weights(buffers.layers[l], size, learning_rate);
+
+            get_parameters(parameters);
+            version++;
+
+            //Print the cost each time the workers have gone through the dataset once more
+            if(version % batches_per_epoch == 0)
+                std::cout << "Cost for epoch " << version / batches_per_epoch - 1 << ": " << cost(dataset,0,100) << std::endl;
+        }
+
+        group.release(parameters, version);
+    }
+
+    std::cout << "Most updates missed by a gradient: " << group.get_max_delay() << std::endl;
+    std::cout << "Gradient bytes per batch (" << compression_name(group.get_compression()) << "): "
+              << group.get_bytes_per_push() << " of " << gradient_size() * sizeof(accumulator) << std::endl;
+}
+
+
+void n_network::learn_hogwild(const data_set& dataset, int batch_size, real learning_rate, int epochs){
+    //Print initial cost
+    std::cout << "Initial cost: "<< cost(dataset,0,100) << std::endl;
+
+    thread_pool pool(threads);
+    const int samples = dataset.size();
+
+    //Buffers of each thread
+    vector<training_buffers> buffers(pool.size());
+    for(training_buffers& b : buffers)
+        prepare_buffers(b);
+
     //For each epoch
     for(int epoch = 0; epoch < epochs; epoch++){
+        atomic<int> next(0);
+
+        //Each thread takes batches until the dataset runs out
+        pool.run([&](int t){
+            for(int i = next.fetch_add(batch_size); i < samples; i = next.fetch_add(batch_size)){
+                int size = min(batch_size, samples - i);
+
+                calculate_gradient(dataset, i, size, buffers[t]);
+
+                //Apply the gradients right away, other threads may be reading or writing the weights
+                for(int l = 0; l < num_layers; l++){
+                    if(l == 0 && use_sparse(dataset, i, size))
+                        layers[l].update_weights(buffers[t].layers[l], size, learning_rate, dataset.sparse_batch(i, size));
+                    else
+                        layers[l].update_weights(buffers[t].layers[l], size, learning_rate);
+                }
+            }
+        });
+
+        //Print the updated cost
+        std::cout << "Cost for epoch " << epoch << ": " << cost(dataset,0,100) << std::endl;
+    }
+}
+
 
-        //For each element in the dataset
-        for(int i = 0; i < dataset.data.size(); i++){
-            
-            //Forward pass till reaching the batch size
-            vector<double> aux(this->num_outputs, 0);
-            aux[dataset.labels[i]] = 1;
+void n_network::learn_pipeline(const data_set& dataset, int batch_size, real learning_rate, int epochs,
+                               int micro_batch, pipeline_schedule schedule){
+    //Print initial cost
+    std::cout << "Initial cost: "<< cost(dataset,0,100) << std::endl;
+
+    thread_pool pool(threads);
+    const int stages = min(pool.size(), num_layers);
+    const int micro_batches = (batch_size + micro_batch - 1) / micro_batch;
 
-            //Update the gradients
-            this->calculate_gradient(dataset.data[i], aux);
+    //Micro-batches in flight: all of them with GPipe, one per stage with 1F1B
+    const int slots = schedule == pipeline_schedule::gpipe ? micro_batches : min(stages, micro_batches);
 
-            //Update weights once a batch is reached
-            if(i % batch_size == 0)
-                this->update_weights(batch_size, learning_rate);
+    //Activations and deltas of each micro-batch in flight
+    vector<training_buffers> in_flight(slots);
+    for(training_buffers& slot : in_flight)
+        slot.layers.resize(num_layers);
 
+    //Gradients of each layer, only used by the stage that owns it
+    vector<layer_buffers> gradients(num_layers);
+    for(int l = 0; l < num_layers; l++)
+        layers[l].initialize_gradient(gradients[l]);
+
+    //Queues between neighbour stages: micro-batches going forward, and going back with their deltas
+    vector<unique_ptr<spsc_queue<int>>> forward, backward;
+    for(int s = 0; s + 1 < stages; s++){
+        forward.emplace_back(new spsc_queue<int>(slots));
+        backward.emplace_back(new spsc_queue<int>(slots));
+    }
+
+    //First layer of each stage (and one past the last layer of the last stage)
+    auto first_layer = [&](int stage){return num_layers * stage / stages;};
+
+    //Current batch
+    int start = 0, size = 0;
+
+    auto forward_pass = [&](int stage, int m){
+        training_buffers& slot = in_flight[m % slots];
+        const int first = start + m * micro_batch, n = min(micro_batch, start + size - first);
+        int l = first_layer(stage);
+
+        //The first stage reads the samples
+        if(stage == 0){
+            load_expected(dataset, first, n, slot.expected);
+
+            if(use_sparse(dataset, first, n))
+                layers[0].calculate_outputs(dataset.sparse_batch(first, n), slot.layers[0]);
+            else{
+                dataset.load_batch(first, n, slot.inputs);
+                layers[0].calculate_outputs(slot.inputs, slot.layers[0]);
+            }
+            l++;
+        }
+
+        for(; l < first_layer(stage + 1); l++)
+            layers[l].calculate_outputs(slot.layers[l - 1].outputs, slot.layers[l]);
+    };
+
+    auto backward_pass = [&](int stage, int m){
+        training_buffers& slot = in_flight[m % slots];
+        const int first = start + m * micro_batch, n = min(micro_batch, start + size - first);
+
+        auto layer_gradient = [&](int l, const auto& inputs){
+            //Lend the gradients of the layer to the buffers of the micro-batch (no copy)
+            swap(slot.layers[l].weight_gradients, gradients[l].weight_gradients);
+            swap(slot.layers[l].bias_gradients, gradients[l].bias_gradients);
+
+            if(l == num_layers - 1)
+                layers[l].calculate_output_gradient(inputs, slot.expected, slot.layers[l]);
+            else
+                layers[l].calculate_hidden_gradient(inputs, layers[l + 1], slot.layers[l + 1], slot.layers[l]);
+
+            swap(slot.layers[l].weight_gradients, gradients[l].weight_gradients);
+            swap(slot.layers[l].bias_gradients, gradients[l].bias_gradients);
+        };
+
+        for(int l = first_layer(stage + 1) - 1; l >= first_layer(stage); l--){
+            if(l > 0) layer_gradient(l, slot.layers[l - 1].outputs);
+            else if(use_sparse(dataset, first, n)) layer_gradient(l, dataset.sparse_batch(first, n));
+            else layer_gradient(l, slot.inputs);
+        }
+    };
+
+    auto run_stage = [&](int stage){
+        const int count = (size + micro_batch - 1) / micro_batch;
+
+        auto forward_step = [&](int m){
+            if(stage > 0) m = forward[stage - 1]->pop();
+            forward_pass(stage, m);
+            if(stage + 1 < stages) forward[stage]->push(m);
+        };
+        auto backward_step = [&](int m){
+            if(stage + 1 < stages) m = backward[stage]->pop();
+            backward_pass(stage, m);
+            if(stage > 0) backward[stage - 1]->push(m);
+        };
+
+        //Fill the pipeline, then alternate (1F1B) or do every backward pass (GPipe)
+        const int warmup = schedule == pipeline_schedule::gpipe ? count : min(stages - stage - 1, count);
+
+        int f = 0, b = 0;
+        for(; f < warmup; f++) forward_step(f);
+        while(b < count){
+            if(f < count) forward_step(f++);
+            backward_step(b++);
+        }
+    };
+
+    //For each epoch
+    for(int epoch = 0; epoch < epochs; epoch++){
+
+        //For each batch in the dataset
+        for(start = 0; start < dataset.size(); start += batch_size){
+            size = min(batch_size, dataset.size() - start);
+
+            //Every stage runs the micro-batches of the batch
+            pool.run([&](int t){
+                if(t < stages) run_stage(t);
+            });
+
+            //Flush: once every gradient of the batch is done each stage updates its layers
+            pool.run([&](int t){
+                if(t < stages)
+                    for(int l = first_layer(t); l < first_layer(t + 1); l++)
+                        layers[l].update_weights(gradients[l], size, learning_rate);
+            });
         }
 
         //Print the updated cost
         std::cout << "Cost for epoch " << epoch << ": " << cost(dataset,0,100) << std::endl;
     }
-
-    //Free gradients
-    this->free_gradients();
 }
 
 
@@ -180,6 +806,16 @@ n_network& n_network::operator=(const n_network& other){
         this->num_layers = other.num_layers;
         this->num_inputs = other.num_inputs;
         this->num_outputs = other.num_outputs;
+        this->sparse_threshold = other.sparse_threshold;
+        this->threads = other.threads;
+        this->deterministic_chunk = other.deterministic_chunk;
+        this->prefetch_depth = other.prefetch_depth;
+        this->prefetch_threads = other.prefetch_threads;
+        this->shuffle_block = other.shuffle_block;
+        this->shuffle_window = other.shuffle_window;
+        this->shuffle_seed = other.shuffle_seed;
+        this->augment_settings = other.augment_settings;
+        this->augment_seed = other.augment_seed;
     }
 
     return *this;
@@ -0,0 +1,214 @@
+#include "parameter_server.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define NN_UNIX_SOCKETS
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifdef NN_UNIX_SOCKETS
+/**
+ * @brief Send a whole buffer through a socket
+ */
+static void send_all(int socket, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while(size > 0){
+        ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+        if(sent <= 0) throw runtime_error("Parameter server: could not send a message");
+        bytes += sent;
+        size -= sent;
+    }
+}
+
+/**
+ * @brief Receive a whole buffer from a socket
+ */
+static void receive_all(int socket, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while(size > 0){
+        ssize_t received = recv(socket, bytes, size, 0);
+        if(received <= 0) throw runtime_error("Parameter server: the other process disconnected");
+        bytes += received;
+        size -= received;
+    }
+}
+#endif
+
+bool parameter_server::supported() {
+#ifdef NN_UNIX_SOCKETS
+    return true;
+#else
+    return false;
+#endif
+}
+
+parameter_server::parameter_server(int workers, int staleness, compression method, double top_k_ratio)
+    : rank(0), workers(workers), staleness(max(0, staleness)), compressor(method, top_k_ratio),
+      last_served(0), version(0), max_delay(0), pushes(0), pushed_bytes(0) {
+#ifdef NN_UNIX_SOCKETS
+    if(workers < 1) throw runtime_error("A parameter server needs at least 1 worker");
+
+    //Two connected ends per worker: the server keeps the first one, the worker the second one
+    for(int w = 0; w < workers; w++){
+        int ends[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0){
+            for(int s : sockets) close(s);
+            throw runtime_error("Could not create the sockets of the parameter server");
+        }
+        sockets.push_back(ends[0]);
+        sockets.push_back(ends[1]);
+    }
+
+    clocks.assign(workers, 0);
+    pulled.assign(workers, 0);
+    waiting.assign(workers, true);
+    finished.assign(workers, false);
+#else
+    throw runtime_error("Parameter servers need Unix domain sockets");
+#endif
+}
+
+parameter_server::~parameter_server() {
+#ifdef NN_UNIX_SOCKETS
+    for(int s : sockets)
+        close(s);
+
+    for(int pid : children)
+        waitpid(pid, nullptr, 0);
+#endif
+}
+
+int parameter_server::fork_workers() {
+#ifdef NN_UNIX_SOCKETS
+    for(int w = 0; w < workers; w++){
+        pid_t pid = fork();
+        if(pid < 0) throw runtime_error("Could not start worker " + to_string(w + 1));
+
+        if(pid == 0){
+            //Worker: keep only its end of its own socket
+            rank = w + 1;
+            children.clear();
+            compressor.seed(rank);
+            for(int s = 0; s < (int)sockets.size(); s++)
+                if(s != 2 * w + 1) close(sockets[s]);
+            sockets = {sockets[2 * w + 1]};
+            return rank;
+        }
+        children.push_back(pid);
+    }
+
+    //Server: keep the first end of every socket
+    vector<int> ends;
+    for(int w = 0; w < workers; w++){
+        close(sockets[2 * w + 1]);
+        ends.push_back(sockets[2 * w]);
+    }
+    sockets = ends;
+#endif
+    return rank;
+}
+
+void parameter_server::pull(array_view<real> parameters) {
+#ifdef NN_UNIX_SOCKETS
+    message header;
+    receive_all(sockets[0], &header, sizeof(header));
+    if(header.type != parameters_message) throw runtime_error("Parameter server: unexpected message");
+
+    receive_all(sockets[0], parameters.data(), parameters.size() * sizeof(real));
+#endif
+}
+
+void parameter_server::push(array_view<const accumulator> gradients, int batch_size) {
+#ifdef NN_UNIX_SOCKETS
+    compressor.compress(gradients, packed);
+
+    message header{gradients_message, batch_size, 0, (long)packed.size()};
+    send_all(sockets[0], &header, sizeof(header));
+    send_all(sockets[0], packed.data(), packed.size());
+#endif
+}
+
+void parameter_server::finish() {
+#ifdef NN_UNIX_SOCKETS
+    message header{finished_message, 0, 0, 0};
+    send_all(sockets[0], &header, sizeof(header));
+#endif
+}
+
+int parameter_server::receive(array_view<accumulator> gradients, int& batch_size) {
+#ifdef NN_UNIX_SOCKETS
+    vector<pollfd> ready;
+    for(int w = 0; w < workers; w++)
+        if(!finished[w]) ready.push_back({sockets[w], POLLIN, 0});
+
+    if(ready.empty()) return 0;
+
+    //Wait for any worker, taking the first one ready after the last served so none starves
+    while(poll(ready.data(), ready.size(), -1) < 0);
+
+    int worker = -1;
+    for(int i = 1; i <= workers && worker < 0; i++){
+        int w = (last_served + i) % workers;
+        for(const pollfd& p : ready)
+            if(p.fd == sockets[w] && p.revents != 0) worker = w;
+    }
+    last_served = worker;
+
+    message header;
+    receive_all(sockets[worker], &header, sizeof(header));
+
+    if(header.type == finished_message){
+        finished[worker] = true;
+        waiting[worker] = false;
+        batch_size = 0;
+    }
+    else{
+        packed.resize(header.bytes);
+        receive_all(sockets[worker], packed.data(), packed.size());
+        compressor.decompress(packed, gradients);
+        batch_size = header.batch_size;
+
+        pushes++;
+        pushed_bytes += header.bytes;
+
+        clocks[worker]++;
+        waiting[worker] = true;
+        max_delay = max(max_delay, version - pulled[worker]);
+    }
+
+    return worker + 1;
+#else
+    return 0;
+#endif
+}
+
+void parameter_server::release(array_view<const real> parameters, long version) {
+#ifdef NN_UNIX_SOCKETS
+    this->version = version;
+
+    //Clock of the slowest worker still training
+    long slowest = -1;
+    for(int w = 0; w < workers; w++)
+        if(!finished[w] && (slowest < 0 || clocks[w] < slowest)) slowest = clocks[w];
+
+    for(int w = 0; w < workers; w++)
+        if(waiting[w] && clocks[w] - slowest <= staleness){
+            message header{parameters_message, 0, version, (long)(parameters.size() * sizeof(real))};
+            send_all(sockets[w], &header, sizeof(header));
+            send_all(sockets[w], parameters.data(), parameters.size() * sizeof(real));
+
+            waiting[w] = false;
+            pulled[w] = version;
+        }
+#endif
+}
@@ -0,0 +1,172 @@
+#include "shm_all_reduce.h"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define NN_POSIX_SHM
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+static_assert(atomic<int>::is_always_lock_free, "Barriers in shared memory need lock free atomics");
+
+bool shm_all_reduce::supported() {
+#ifdef NN_POSIX_SHM
+    return true;
+#else
+    return false;
+#endif
+}
+
+shm_all_reduce::shm_all_reduce(int world_size, size_t count)
+    : rank(0), world_size(world_size), count(count), stride(padded_size<accumulator>((int)count)),
+      bytes(0), shared(nullptr), parent(0), exited(0) {
+#ifdef NN_POSIX_SHM
+    if(world_size < 1) throw runtime_error("The world size must be at least 1");
+
+    bytes = sizeof(control) + (size_t)world_size * stride * sizeof(accumulator);
+
+    //Named shared memory, unlinked as soon as it is mapped: forked ranks inherit the mapping
+    string name = "/nn_all_reduce_" + to_string(getpid());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0) throw runtime_error("Could not create the shared memory " + name);
+
+    if(ftruncate(fd, (off_t)bytes) != 0){
+        close(fd);
+        shm_unlink(name.c_str());
+        throw runtime_error("Could not size the shared memory " + name);
+    }
+
+    void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    shm_unlink(name.c_str());
+    if(memory == MAP_FAILED) throw runtime_error("Could not map the shared memory " + name);
+
+    //New shared memory is zero filled, only the atomics need constructing
+    shared = new(memory) control();
+    shared->arrived = 0;
+    shared->generation = 0;
+    shared->aborted = 0;
+#else
+    throw runtime_error("Shared memory all-reduce needs a POSIX system");
+#endif
+}
+
+shm_all_reduce::~shm_all_reduce() {
+#ifdef NN_POSIX_SHM
+    for(int pid : children)
+        if(pid > 0) waitpid(pid, nullptr, 0);
+
+    if(shared) munmap(shared, bytes);
+#endif
+}
+
+int shm_all_reduce::fork_ranks() {
+#ifdef NN_POSIX_SHM
+    pid_t self = getpid();
+    for(int r = 1; r < world_size; r++){
+        pid_t pid = fork();
+        if(pid < 0) throw runtime_error("Could not start rank " + to_string(r));
+
+        if(pid == 0){
+            //Child: it does not wait for its siblings
+            rank = r;
+            parent = self;
+            children.clear();
+            return rank;
+        }
+        children.push_back(pid);
+    }
+#endif
+    return rank;
+}
+
+accumulator* shm_all_reduce::slot(int index) const {
+    return reinterpret_cast<accumulator*>(shared + 1) + (size_t)index * stride;
+}
+
+array_view<accumulator> shm_all_reduce::buffer() {
+    return array_view<accumulator>(slot(rank), (int)count);
+}
+
+void shm_all_reduce::barrier() {
+    if(world_size == 1) return;
+
+    int generation = shared->generation.load(memory_order_acquire);
+
+    //The last process to arrive releases the others
+    if(shared->arrived.fetch_add(1, memory_order_acq_rel) == world_size - 1){
+        shared->arrived.store(0, memory_order_relaxed);
+        shared->generation.fetch_add(1, memory_order_release);
+    }
+    else
+        for(int spins = 1; shared->generation.load(memory_order_acquire) == generation; spins++){
+            //Every so often make sure the ranks that have not arrived are still there
+            if(spins % 1024 == 0 && failed()){
+                //A rank can finish right after releasing the last barrier
+                if(shared->generation.load(memory_order_acquire) != generation) break;
+                abort();
+                throw runtime_error("A process of the all-reduce group failed");
+            }
+            this_thread::yield();
+        }
+
+    if(shared->aborted.load(memory_order_acquire))
+        throw runtime_error("A process of the all-reduce group failed");
+}
+
+void shm_all_reduce::abort() {
+    if(shared) shared->aborted.store(1, memory_order_release);
+}
+
+bool shm_all_reduce::failed() {
+    if(shared->aborted.load(memory_order_acquire)) return true;
+
+#ifdef NN_POSIX_SHM
+    //Rank 0 reaps the ranks that exited, they will never arrive at another barrier
+    for(int& pid : children)
+        if(pid > 0 && waitpid(pid, nullptr, WNOHANG) == pid){
+            pid = -1;
+            exited++;
+        }
+
+    //The other ranks are moved to another parent when rank 0 dies
+    return exited > 0 || (rank != 0 && getppid() != parent);
+#else
+    return false;
+#endif
+}
+
+void shm_all_reduce::all_reduce() {
+    if(world_size == 1) return;
+
+    const int left = (rank + world_size - 1) % world_size;
+    accumulator* mine = slot(rank);
+    const accumulator* theirs = slot(left);
+
+    auto chunk_start = [&](int chunk){return count * chunk / world_size;};
+
+    //The arrays of every rank are written
+    barrier();
+
+    //Reduce-scatter: add the chunk the left neighbour has just summed, after the last step
+    //chunk rank + 1 holds the sum of every rank
+    for(int step = 0; step < world_size - 1; step++){
+        int chunk = (rank - step - 1 + 2 * world_size) % world_size;
+        for(size_t i = chunk_start(chunk); i < chunk_start(chunk + 1); i++)
+            mine[i] += theirs[i];
+        barrier();
+    }
+
+    //All-gather: copy the finished chunk the left neighbour has just received
+    for(int step = 0; step < world_size - 1; step++){
+        int chunk = (rank - step + world_size) % world_size;
+        copy(theirs + chunk_start(chunk), theirs + chunk_start(chunk + 1), mine + chunk_start(chunk));
+        barrier();
+    }
+}
@@ -0,0 +1,86 @@
+#include "streaming_data_set.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+//Bytes of the headers of the image and label files
+static const int DATA_HEADER = 4 * sizeof(int), LABEL_HEADER = 2 * sizeof(int);
+
+streaming_data_set::streaming_data_set(const string& data_path, const string& label_path, size_t memory_budget,
+                                       int chunk_samples, unsigned seed, io_backend backend, bool direct)
+    : data_path(data_path), label_path(label_path), buffered(0), read(0), random(seed),
+      window(nullptr, nullptr, 0, 0) {
+    int num_rows, num_cols;
+    data_set::read_headers(data_path, label_path, fi_data, fi_labels, num_samples, num_rows, num_cols);
+    num_pixels = num_rows * num_cols;
+
+    //The buffer holds whole samples (pixels and label)
+    capacity = (int)max<size_t>(1, min<size_t>(memory_budget / (num_pixels + 1), max(1, num_samples)));
+    chunk = chunk_samples > 0 ? min(chunk_samples, capacity) : max(1, capacity / 4);
+
+    images.resize((size_t)capacity * num_pixels);
+    labels.resize(capacity);
+
+    //Blocks of about a read each, so the next read is loading while a window trains
+    if(backend != io_backend::stream){
+        size_t block = min<size_t>(max<size_t>((size_t)chunk * num_pixels, 1 << 16), 4 << 20);
+        data_reader = make_unique<async_reader>(data_path, backend, direct, block);
+        label_reader = make_unique<async_reader>(label_path, backend, direct, 1 << 16);
+        fi_data.close();
+        fi_labels.close();
+        rewind();
+    }
+}
+
+void streaming_data_set::rewind() {
+    if(data_reader){
+        data_reader->seek(DATA_HEADER);
+        label_reader->seek(LABEL_HEADER);
+    }
+    else{
+        fi_data.clear();
+        fi_labels.clear();
+        fi_data.seekg(DATA_HEADER);
+        fi_labels.seekg(LABEL_HEADER);
+    }
+
+    buffered = read = 0;
+}
+
+const data_set* streaming_data_set::next() {
+    //Fill the buffer a chunk at a time
+    while(buffered < capacity && read < num_samples){
+        int count = min({chunk, capacity - buffered, num_samples - read});
+
+        if(data_reader){
+            data_reader->read(images.data() + (size_t)buffered * num_pixels, (size_t)count * num_pixels);
+            label_reader->read(labels.data() + buffered, count);
+        }
+        else{
+            fi_data.read((char*)images.data() + (size_t)buffered * num_pixels, (streamsize)count * num_pixels);
+            fi_labels.read((char*)labels.data() + buffered, count);
+            if(!fi_data || !fi_labels) throw runtime_error("Truncated MNIST file: " + data_path);
+        }
+
+        //Each new sample swaps places with a random one of the buffer (itself included)
+        for(int k = buffered; k < buffered + count; k++){
+            int j = uniform_int_distribution<int>(0, k)(random);
+            if(j == k) continue;
+
+            swap_ranges(images.begin() + (size_t)k * num_pixels, images.begin() + (size_t)(k + 1) * num_pixels,
+                        images.begin() + (size_t)j * num_pixels);
+            swap(labels[k], labels[j]);
+        }
+
+        buffered += count;
+        read += count;
+    }
+
+    if(buffered == 0) return nullptr;
+
+    //The window is the end of the buffer, refilled by the next call
+    int count = min(chunk, buffered);
+    buffered -= count;
+    window = data_set(images.data() + (size_t)buffered * num_pixels, labels.data() + buffered, count, num_pixels);
+    return &window;
+}
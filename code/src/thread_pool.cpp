@@ -0,0 +1,86 @@
+#include "thread_pool.h"
+
+//Checks of a flag before sleeping on it
+static const int SPIN = 1 << 14;
+
+thread_pool::thread_pool(int threads)
+    : threads(threads > 0 ? threads : hardware_threads()), task(nullptr), call(nullptr),
+      generation(0), pending(0), busy(false), stop(false) {
+    for(int i = 1; i < this->threads; i++)
+        workers.emplace_back(&thread_pool::worker, this, i);
+}
+
+thread_pool::~thread_pool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stop = true;
+        generation++;
+    }
+    wake.notify_all();
+
+    for(thread& t : workers)
+        t.join();
+}
+
+int thread_pool::hardware_threads() {
+    return max(1, (int)thread::hardware_concurrency());
+}
+
+void thread_pool::run(const void* task, void (*call)(const void* task, int index)) {
+    //Busy (or nothing to share): the caller does all the work
+    if(threads == 1 || busy.exchange(true, memory_order_acquire)){
+        for(int i = 0; i < threads; i++)
+            call(task, i);
+        return;
+    }
+
+    //Start the workers
+    this->task = task;
+    this->call = call;
+    pending = threads - 1;
+    {
+        lock_guard<mutex> guard(lock);
+        generation++;
+    }
+    wake.notify_all();
+
+    //The caller is thread 0
+    call(task, 0);
+
+    //Wait for the workers, spinning first since they usually finish at the same time
+    for(int i = 0; i < SPIN && pending.load(memory_order_acquire) > 0; i++)
+        this_thread::yield();
+
+    {
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [&]{return pending.load(memory_order_acquire) == 0;});
+    }
+
+    busy.store(false, memory_order_release);
+}
+
+void thread_pool::worker(int index) {
+    unsigned seen = 0;
+
+    while(true){
+        //Wait for a new task
+        for(int i = 0; i < SPIN && generation.load(memory_order_acquire) == seen; i++)
+            this_thread::yield();
+
+        if(generation.load(memory_order_acquire) == seen){
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [&]{return generation.load(memory_order_acquire) != seen;});
+        }
+        seen = generation.load(memory_order_acquire);
+
+        if(stop) return;
+
+        call(task, index);
+
+        //The last worker to finish wakes the caller up
+        if(pending.fetch_sub(1, memory_order_acq_rel) == 1){
+            lock_guard<mutex> guard(lock);
+            done.notify_one();
+        }
+    }
+}
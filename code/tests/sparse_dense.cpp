@@ -0,0 +1,75 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "kernels.h"
+#include "n_network.h"
+
+using namespace std;
+
+/**
+ * @brief Network of main, always with the same initial weights
+ */
+static n_network make_network(){
+    srand(1);
+    n_network network(3, 28*28, 10, sig_activation, sig_activation);
+    network.set_layer_nodes(0, 32);
+    network.set_layer_nodes(1, 16);
+    network.set_input_scale(1.0 / 255);
+    network.set_threads(1);
+    return network;
+}
+
+/**
+ * @brief Check that the sparse and dense input paths give bit-identical results with the scalar kernels
+ * @details Synthetic samples with about 20% non zero pixels. Compares the batch outputs of both
+ * forward passes, then the weights after training one network through each path
+ */
+int main(){
+    if(!set_isa(isa::scalar)){
+        cerr << "FAILED: the scalar kernels can not be selected" << endl;
+        return 1;
+    }
+
+    const int samples = 200, pixels = 28*28;
+    vector<unsigned char> images((size_t)samples * pixels), labels(samples);
+    srand(7);
+    for(unsigned char& pixel : images)
+        pixel = rand() % 5 == 0 ? (unsigned char)(1 + rand() % 255) : 0;
+    for(unsigned char& label : labels)
+        label = (unsigned char)(rand() % 10);
+
+    data_set dataset(images.data(), labels.data(), samples, pixels);
+    dataset.build_sparse();
+
+    //Forward pass of the whole batch through each path
+    n_network network = make_network();
+    byte_matrix inputs;
+    dataset.load_batch(0, samples, inputs);
+    matrix dense = network.calculate_outputs(inputs);
+    const matrix& sparse = network.calculate_outputs(dataset.sparse_batch(0, samples));
+    for(int s = 0; s < samples; s++)
+        if(memcmp(dense.row(s).data(), sparse.row(s).data(), dense.get_cols() * sizeof(real)) != 0){
+            cerr << "FAILED: the outputs of sample " << s << " differ between the sparse and dense paths" << endl;
+            return 1;
+        }
+
+    //Training through each path (the threshold picks the path of every batch)
+    n_network trained_dense = make_network(), trained_sparse = make_network();
+    trained_dense.set_sparse_threshold(0);
+    trained_sparse.set_sparse_threshold(1);
+    trained_dense.learn(dataset, 10, 1, 2);
+    trained_sparse.learn(dataset, 10, 1, 2);
+
+    vector<real> dense_weights(trained_dense.gradient_size()), sparse_weights(trained_sparse.gradient_size());
+    trained_dense.get_parameters(dense_weights);
+    trained_sparse.get_parameters(sparse_weights);
+    if(memcmp(dense_weights.data(), sparse_weights.data(), dense_weights.size() * sizeof(real)) != 0){
+        cerr << "FAILED: the weights differ after training through the sparse and dense paths" << endl;
+        return 1;
+    }
+
+    cout << "OK: sparse and dense paths are bit-identical with the scalar kernels" << endl;
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include "n_network.h"
+
+using namespace std;
+
+static long allocations = 0; //*< Heap allocations since the start */
+
+void* operator new(size_t bytes){
+    allocations++;
+    if(void* p = malloc(bytes ? bytes : 1)) return p;
+    throw bad_alloc();
+}
+
+void* operator new(size_t bytes, align_val_t alignment){
+    allocations++;
+    size_t align = (size_t)alignment;
+    if(void* p = aligned_alloc(align, (bytes + align - 1) / align * align)) return p;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t bytes) {return operator new(bytes);}
+void* operator new[](size_t bytes, align_val_t alignment) {return operator new(bytes, alignment);}
+void operator delete(void* p) noexcept {free(p);}
+void operator delete(void* p, size_t) noexcept {free(p);}
+void operator delete(void* p, align_val_t) noexcept {free(p);}
+void operator delete(void* p, size_t, align_val_t) noexcept {free(p);}
+void operator delete[](void* p) noexcept {free(p);}
+void operator delete[](void* p, size_t) noexcept {free(p);}
+void operator delete[](void* p, align_val_t) noexcept {free(p);}
+void operator delete[](void* p, size_t, align_val_t) noexcept {free(p);}
+
+/**
+ * @brief Check that inference with a workspace performs no heap allocation after the first call
+ */
+int main(){
+    srand(1);
+    n_network network(3, 28*28, 10, sig_activation, sig_activation);
+    network.set_layer_nodes(0, 32);
+    network.set_layer_nodes(1, 16);
+
+    vector<unsigned char> input(28*28);
+    for(size_t i = 0; i < input.size(); i++)
+        input[i] = (unsigned char)(rand() % 256);
+
+    //Warm-up: the workspace is sized on the first call
+    inference_workspace workspace;
+    network.calculate_outputs(input, workspace);
+
+    long before = allocations;
+    real checksum = 0;
+    for(int i = 0; i < 1000; i++){
+        input[i % input.size()] = (unsigned char)i;
+        array_view<const real> outputs = network.calculate_outputs(input, workspace);
+        checksum += outputs[0];
+    }
+    long after = allocations;
+
+    if(after != before){
+        cerr << "FAILED: " << after - before << " heap allocations in 1000 inferences after warm-up" << endl;
+        return 1;
+    }
+    cout << "OK: no heap allocations in 1000 inferences after warm-up (checksum " << checksum << ")" << endl;
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "augmentation.h"
+#include "data_set.h"
+#include "kernels.h"
+
+using namespace std;
+
+/**
+ * @brief Images/s of one set of transforms, each thread with its own workspace
+ * @param images Source images, 28x28 each
+ * @param count Number of images
+ */
+static double throughput(const augmentation& settings, const unsigned char* images, int count, int threads,
+                         double seconds){
+    const int n = settings.rows * settings.cols;
+    augmenter transforms(settings, 1);
+    atomic<long long> done(0);
+    atomic<unsigned> checksum(0);
+
+    auto work = [&](int t){
+        augment_workspace workspace;
+        vector<unsigned char> result(n);
+        unsigned sum = 0;
+        long long i = t;
+
+        //The first image sizes the workspace
+        transforms.apply(images, result.data(), 0, workspace);
+
+        auto start = chrono::steady_clock::now();
+        long long local = 0;
+        while(chrono::duration<double>(chrono::steady_clock::now() - start).count() < seconds){
+            for(int k = 0; k < 256; k++, i += threads, local++){
+                transforms.apply(images + (size_t)(i % count) * n, result.data(), transforms.key(0, (int)i), workspace);
+                sum += result[n / 2];
+            }
+        }
+        done += local;
+        checksum += sum;
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for(int t = 0; t < threads; t++)
+        workers.emplace_back(work, t);
+    for(thread& w : workers)
+        w.join();
+
+    return done / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Throughput of each random transform of the training images
+ * @details bench_augment [images labels] [--threads N] [--seconds S]
+ * Without a dataset, random blobs stand in for the digits. Reports images/s per transform
+ * (the strengths of main --augment, noise 16) with N threads and per thread
+ */
+int main(int argc, char** argv){
+    string paths[2];
+    int num_paths = 0, threads = 1;
+    double seconds = 1;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) seconds = atof(argv[++i]);
+        else if(num_paths < 2) paths[num_paths++] = argv[i];
+    }
+    if(num_paths == 1){
+        cerr << "Usage: " << argv[0] << " [images.idx labels.idx] [--threads N] [--seconds S]" << endl;
+        return 1;
+    }
+
+    //Source images: the dataset, or random blobs
+    const int n = 28 * 28;
+    vector<unsigned char> images;
+    int count = 0;
+    if(num_paths == 2){
+        data_set d(paths[0], paths[1], dataset_storage::mapped);
+        if(d.sample_size() != n){
+            cerr << "The images have to be 28x28" << endl;
+            return 1;
+        }
+        count = d.size();
+        images.resize((size_t)count * n);
+        for(int i = 0; i < count; i++)
+            d.copy_sample(i, images.data() + (size_t)i * n);
+    }
+    else{
+        srand(1);
+        count = 1024;
+        images.assign((size_t)count * n, 0);
+        for(int i = 0; i < count; i++)
+            for(int b = 0; b < 6; b++){
+                int cx = 6 + rand() % 16, cy = 6 + rand() % 16;
+                for(int y = cy - 3; y <= cy + 3; y++)
+                    for(int x = cx - 3; x <= cx + 3; x++)
+                        images[(size_t)i * n + y * 28 + x] = 255;
+            }
+    }
+
+    cout << "Kernels: " << isa_name(kernels().type) << ", " << threads << " threads (images/s, per thread)" << endl;
+
+    const char* names[] = {"none", "shift", "rotation", "elastic", "noise", "all"};
+    for(int t = 0; t < 6; t++){
+        augmentation settings;
+        if(t == 1 || t == 5) settings.max_shift = 2;
+        if(t == 2 || t == 5) settings.max_rotation = 0.15;
+        if(t == 3 || t == 5) settings.elastic_alpha = 34;
+        if(t == 4 || t == 5) settings.noise = 16;
+
+        double speed = throughput(settings, images.data(), count, threads, seconds);
+        cout << names[t] << ": " << (long long)speed << " (" << (long long)(speed / threads) << ")" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "n_network.h"
+#include "shm_all_reduce.h"
+
+using namespace std;
+
+/**
+ * @brief Samples/s of multi-process training for every world size from 1 to N
+ * @details bench_distributed images.idx labels.idx [--max-world-size N] [--batch B] [--epochs E]
+ * Trains the 784-32-16-10 network of main with learn_distributed. Every batch of B samples is
+ * split among the processes and costs one all-reduce of the whole gradient, so small batches
+ * measure the communication and large ones the computation
+ */
+int main(int argc, char** argv){
+    string paths[2];
+    int num_paths = 0, max_world_size = 4, batch_size = 10, epochs = 1;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--max-world-size") == 0 && i + 1 < argc) max_world_size = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batch_size = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--epochs") == 0 && i + 1 < argc) epochs = max(1, atoi(argv[++i]));
+        else if(num_paths < 2) paths[num_paths++] = argv[i];
+    }
+    if(num_paths < 2){
+        cerr << "Usage: " << argv[0] << " images.idx labels.idx [--max-world-size N] [--batch B] [--epochs E]" << endl;
+        return 1;
+    }
+    if(!shm_all_reduce::supported()){
+        cerr << "Shared memory all-reduce is not supported on this system" << endl;
+        return 1;
+    }
+
+    data_set dataset(paths[0], paths[1]);
+    double single = 0;
+
+    for(int world_size = 1; world_size <= max_world_size; world_size++){
+        srand(1);
+        n_network network(3, 28*28, 10, sig_activation, sig_activation);
+        network.set_layer_nodes(0, 32);
+        network.set_layer_nodes(1, 16);
+        network.set_input_scale(1.0 / 255);
+
+        auto start = chrono::steady_clock::now();
+        {
+            shm_all_reduce group(world_size, network.gradient_size());
+            int rank = group.fork_ranks();
+            network.learn_distributed(dataset, batch_size, 1, epochs, group);
+            if(rank != 0) return 0;
+        } //Rank 0 waits for the others here
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        double speed = (double)dataset.size() * epochs / seconds;
+        if(world_size == 1) single = speed;
+        cout << "world size " << world_size << ": " << (long long)speed << " samples/s, "
+             << seconds << " s, speedup " << speed / single << "x" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "n_network.h"
+
+using namespace std;
+
+/**
+ * @brief Network of main, always with the same initial weights
+ */
+static n_network make_network(){
+    srand(1);
+    n_network network(3, 28*28, 10, sig_activation, sig_activation);
+    network.set_layer_nodes(0, 32);
+    network.set_layer_nodes(1, 16);
+    network.set_input_scale(1.0 / 255);
+    return network;
+}
+
+/**
+ * @brief Train one epoch at a time until the cost of the dataset reaches a target
+ * @param hogwild learn_hogwild instead of learn
+ * @param threads Number of threads
+ * @param epochs Epochs trained (output)
+ * @param cost Cost of the dataset at the end (output)
+ * @return Seconds spent training (the cost checks are not counted)
+ */
+static double time_to_target(const data_set& dataset, bool hogwild, int threads, int batch_size,
+                             double target, int max_epochs, int& epochs, double& cost){
+    n_network network = make_network();
+    network.set_threads(threads);
+
+    //The costs printed by learn are not part of the report
+    ostringstream quiet;
+    streambuf* previous = cout.rdbuf(quiet.rdbuf());
+
+    double seconds = 0;
+    cost = network.cost(dataset, 0, dataset.size());
+    for(epochs = 0; epochs < max_epochs && cost > target; epochs++){
+        auto start = chrono::steady_clock::now();
+        if(hogwild) network.learn_hogwild(dataset, batch_size, 1, 1);
+        else network.learn(dataset, batch_size, 1, 1);
+        seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cost = network.cost(dataset, 0, dataset.size());
+    }
+
+    cout.rdbuf(previous);
+    return seconds;
+}
+
+/**
+ * @brief Wall time to a target cost of learn on 1 thread and of learn_hogwild on 1 to N threads
+ * @details bench_hogwild images.idx labels.idx [--threads N] [--batch B] [--target COST] [--max-epochs E]
+ * Trains the 784-32-16-10 network of main from the same initial weights every time. Hogwild
+ * threads update the weights without waiting for each other, so each epoch is faster but
+ * may need more epochs to reach the same cost: the time to the target counts both
+ */
+int main(int argc, char** argv){
+    string paths[2];
+    int num_paths = 0, max_threads = 4, batch_size = 10, max_epochs = 20;
+    double target = 0.002;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) max_threads = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batch_size = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--target") == 0 && i + 1 < argc) target = atof(argv[++i]);
+        else if(strcmp(argv[i], "--max-epochs") == 0 && i + 1 < argc) max_epochs = max(1, atoi(argv[++i]));
+        else if(num_paths < 2) paths[num_paths++] = argv[i];
+    }
+    if(num_paths < 2){
+        cerr << "Usage: " << argv[0] << " images.idx labels.idx [--threads N] [--batch B] [--target COST] [--max-epochs E]" << endl;
+        return 1;
+    }
+
+    data_set dataset(paths[0], paths[1]);
+    double single = 0;
+
+    for(int run = 0; run <= max_threads; run++){
+        //Run 0 is the synchronous baseline, then Hogwild with 1 to N threads
+        bool hogwild = run > 0;
+        int threads = hogwild ? run : 1, epochs;
+        double cost;
+        double seconds = time_to_target(dataset, hogwild, threads, batch_size, target, max_epochs, epochs, cost);
+        if(run == 0) single = seconds;
+
+        cout << (hogwild ? "learn_hogwild, " : "learn, ") << threads << " thread" << (threads > 1 ? "s: " : ": ")
+             << epochs << " epochs, " << seconds << " s, cost " << cost;
+        if(cost > target) cout << " (target " << target << " not reached)";
+        else cout << ", speedup " << single / seconds << "x";
+        cout << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "async_reader.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/**
+ * @brief Drop a file from the page cache, so the next read comes from the disk
+ * @return False if the system cannot do it
+ */
+static bool evict(const string& path){
+#if defined(POSIX_FADV_DONTNEED)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    bool done = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    ::close(fd);
+    return done;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+/**
+ * @brief Stand-in for the training between reads: busy for work_ns nanoseconds per byte read
+ */
+static void work(size_t bytes, double work_ns){
+    auto start = chrono::steady_clock::now();
+    while(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() < work_ns * bytes);
+}
+
+/**
+ * @brief Read a whole file in chunks with one backend
+ * @return Throughput in MB/s
+ */
+static double read_file(const string& path, io_backend backend, bool direct, size_t chunk, double work_ns,
+                        size_t& checksum){
+    vector<unsigned char> buffer(chunk);
+    size_t total = 0;
+    auto start = chrono::steady_clock::now();
+
+    if(backend == io_backend::stream){
+        ifstream file(path, ios::binary);
+        while(file.read((char*)buffer.data(), (streamsize)chunk) || file.gcount() > 0){
+            size_t count = (size_t)file.gcount();
+            for(size_t i = 0; i < count; i += 4096)
+                checksum += buffer[i];
+            total += count;
+            work(count, work_ns);
+        }
+    }
+    else{
+        ifstream file(path, ios::binary | ios::ate);
+        size_t size = (size_t)file.tellg();
+        async_reader reader(path, backend, direct, 4 << 20);
+        while(total < size){
+            size_t count = min(chunk, size - total);
+            reader.read(buffer.data(), count);
+            for(size_t i = 0; i < count; i += 4096)
+                checksum += buffer[i];
+            total += count;
+            work(count, work_ns);
+        }
+    }
+
+    return total / chrono::duration<double>(chrono::steady_clock::now() - start).count() / 1e6;
+}
+
+/**
+ * @brief Read throughput of every I/O backend of the streamed dataset, on cold and warm page cache
+ * @details bench_io file [--chunk BYTES] [--work NS_PER_BYTE] [--repeat N]
+ * Cold runs drop the file from the page cache first (POSIX_FADV_DONTNEED), --work adds busy
+ * time per byte read to see how much of the reads each backend hides behind the training
+ */
+int main(int argc, char** argv){
+    string path;
+    size_t chunk = 1 << 20;
+    double work_ns = 0;
+    int repeat = 3;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--chunk") == 0 && i + 1 < argc) chunk = (size_t)atol(argv[++i]);
+        else if(strcmp(argv[i], "--work") == 0 && i + 1 < argc) work_ns = atof(argv[++i]);
+        else if(strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat = max(1, atoi(argv[++i]));
+        else path = argv[i];
+    }
+
+    if(path.empty() || chunk == 0){
+        cerr << "Usage: " << argv[0] << " file [--chunk BYTES] [--work NS_PER_BYTE] [--repeat N]" << endl;
+        return 1;
+    }
+
+    cout << "io_uring " << (async_reader::io_uring_supported() ? "available" : "not available, uring uses pread")
+         << ", reads of " << chunk << " bytes, median of " << repeat << " (MB/s)" << endl;
+
+    size_t checksum = 0;
+    for(bool cold : {true, false}){
+        if(cold && !evict(path)) cout << "The page cache cannot be dropped here, cold runs are warm" << endl;
+
+        for(io_backend backend : {io_backend::stream, io_backend::pread, io_backend::io_uring})
+            for(bool direct : {false, true}){
+                if(direct && backend == io_backend::stream) continue;
+
+                vector<double> speeds;
+                try{
+                    for(int r = 0; r < repeat; r++){
+                        if(cold) evict(path);
+                        else if(r == 0) read_file(path, backend, direct, chunk, 0, checksum); //Fill the cache
+                        speeds.push_back(read_file(path, backend, direct, chunk, work_ns, checksum));
+                    }
+                }
+                catch(const exception& e){
+                    cerr << e.what() << endl;
+                    return 1;
+                }
+                sort(speeds.begin(), speeds.end());
+
+                cout << (cold ? "cold " : "warm ") << io_backend_name(backend) << (direct ? " direct" : "")
+                     << ": " << speeds[speeds.size() / 2] << endl;
+            }
+    }
+
+    cout << "Checksum: " << checksum << endl;
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "n_network.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+/**
+ * @brief Percentile of sorted times
+ */
+static double percentile(const vector<double>& sorted, double fraction){
+    return sorted[min(sorted.size() - 1, (size_t)(fraction * (double)sorted.size()))];
+}
+
+/**
+ * @brief Latency (p50 and p99) of a single input through calculate_outputs with a workspace,
+ * for several widths of the first hidden layer and thread pool sizes
+ * @details bench_latency [--threads N] [--calls C]
+ * The network is 784-W-16-10 on random pixels. A pool size of 1 runs every layer on the
+ * caller; larger pools split the nodes of the first layer across the pool (the threshold is
+ * its number of weights, the other layers are too small). The smallest layer (in weights)
+ * for which a pool is faster is the value to give layer::PARALLEL_THRESHOLD on this machine
+ */
+int main(int argc, char** argv){
+    int max_threads = 4, calls = 2000;
+    for(int i = 1; i + 1 < argc; i++){
+        if(strcmp(argv[i], "--threads") == 0) max_threads = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--calls") == 0) calls = max(1, atoi(argv[++i]));
+    }
+
+    const int widths[] = {32, 128, 512, 2048};
+    vector<unsigned char> input(28*28);
+    srand(1);
+    for(unsigned char& pixel : input) pixel = (unsigned char)(rand() % 256);
+
+    vector<double> times(calls);
+    long threshold = -1;
+
+    for(int width : widths){
+        srand(1);
+        n_network network(3, 28*28, 10, sig_activation, sig_activation);
+        network.set_layer_nodes(0, width);
+        network.set_layer_nodes(1, 16);
+        network.set_input_scale(1.0 / 255);
+        inference_workspace workspace;
+        network.prepare_workspace(workspace);
+
+        const long weights = (long)width * 28*28;
+        double single = 0;
+        cout << "784-" << width << "-16-10 (" << weights << " weights in the first layer)" << endl;
+
+        for(int threads = 1; threads <= max_threads; threads++){
+            thread_pool pool(threads);
+            network.set_thread_pool(threads > 1 ? &pool : nullptr, weights);
+
+            for(int i = 0; i < 64; i++) network.calculate_outputs(input, workspace);
+            for(int i = 0; i < calls; i++){
+                auto start = chrono::steady_clock::now();
+                network.calculate_outputs(input, workspace);
+                times[i] = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+            }
+            sort(times.begin(), times.end());
+
+            double p50 = percentile(times, 0.5), p99 = percentile(times, 0.99);
+            if(threads == 1) single = p50;
+            else if(p50 < single && (threshold < 0 || weights < threshold)) threshold = weights;
+            cout << "  pool of " << threads << ": p50 " << p50 << " us, p99 " << p99 << " us" << endl;
+            network.set_thread_pool(nullptr);
+        }
+    }
+
+    if(threshold < 0) cout << "No width is faster with a pool (default threshold " << layer::PARALLEL_THRESHOLD << ")" << endl;
+    else cout << "Smallest layer faster with a pool: " << threshold << " weights (default threshold "
+              << layer::PARALLEL_THRESHOLD << ")" << endl;
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "n_network.h"
+
+using namespace std;
+
+/**
+ * @brief Modes of training compared
+ */
+enum class mode {learn, gpipe, one_f_one_b};
+
+/**
+ * @brief Samples/s of learn_pipeline with the GPipe and 1F1B schedules against learn
+ * @details bench_pipeline images.idx labels.idx [--threads N] [--batch B] [--micro M] [--epochs E]
+ * Trains the 784-32-16-10 network of main (3 layers, so at most 3 stages). learn runs on one
+ * thread and on N threads, the pipeline on N stages with micro-batches of M samples. A batch
+ * smaller than two micro-batches leaves the pipeline with nothing to overlap
+ */
+int main(int argc, char** argv){
+    string paths[2];
+    int num_paths = 0, threads = 3, batch_size = 64, micro_batch = 16, epochs = 1;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batch_size = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--micro") == 0 && i + 1 < argc) micro_batch = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--epochs") == 0 && i + 1 < argc) epochs = max(1, atoi(argv[++i]));
+        else if(num_paths < 2) paths[num_paths++] = argv[i];
+    }
+    if(num_paths < 2){
+        cerr << "Usage: " << argv[0] << " images.idx labels.idx [--threads N] [--batch B] [--micro M] [--epochs E]" << endl;
+        return 1;
+    }
+
+    data_set dataset(paths[0], paths[1]);
+    const struct {const char* name; mode how; int threads;} runs[] = {
+        {"learn", mode::learn, 1},
+        {"learn", mode::learn, threads},
+        {"GPipe", mode::gpipe, threads},
+        {"1F1B", mode::one_f_one_b, threads}
+    };
+    double single = 0;
+
+    for(const auto& run : runs){
+        if(&run == &runs[1] && threads == 1) continue;
+
+        srand(1);
+        n_network network(3, 28*28, 10, sig_activation, sig_activation);
+        network.set_layer_nodes(0, 32);
+        network.set_layer_nodes(1, 16);
+        network.set_input_scale(1.0 / 255);
+        network.set_threads(run.threads);
+
+        //The costs printed by learn are not part of the report
+        ostringstream quiet;
+        streambuf* previous = cout.rdbuf(quiet.rdbuf());
+        auto start = chrono::steady_clock::now();
+        if(run.how == mode::learn) network.learn(dataset, batch_size, 1, epochs);
+        else network.learn_pipeline(dataset, batch_size, 1, epochs, micro_batch,
+                                    run.how == mode::gpipe ? pipeline_schedule::gpipe : pipeline_schedule::one_f_one_b);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout.rdbuf(previous);
+
+        double speed = (double)dataset.size() * epochs / seconds;
+        if(&run == &runs[0]) single = speed;
+        cout << run.name << ", " << run.threads << " thread" << (run.threads > 1 ? "s: " : ": ")
+             << (long long)speed << " samples/s, " << seconds << " s, speedup " << speed / single << "x" << endl;
+    }
+
+    return 0;
+}
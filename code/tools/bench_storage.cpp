@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "data_set.h"
+#include "kernels.h"
+
+using namespace std;
+
+/**
+ * @brief Memory and batch loading speed of every dataset storage
+ * @details bench_storage images.idx labels.idx [--batch N] [--repeat N]
+ * Prints the bytes each storage holds in memory and the samples/s of load_batch gathering
+ * batches in a scattered order, with every instruction set the CPU supports (only the
+ * decoding of compressed samples depends on it)
+ */
+int main(int argc, char** argv){
+    string paths[2];
+    int num_paths = 0, batch_size = 64, repeat = 5;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batch_size = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat = max(1, atoi(argv[++i]));
+        else if(num_paths < 2) paths[num_paths++] = argv[i];
+    }
+    if(num_paths < 2){
+        cerr << "Usage: " << argv[0] << " images.idx labels.idx [--batch N] [--repeat N]" << endl;
+        return 1;
+    }
+
+    const char* names[] = {"owning", "mapped", "compressed"};
+    dataset_storage storages[] = {dataset_storage::owning, dataset_storage::mapped, dataset_storage::compressed};
+    vector<data_set> sets;
+    sets.reserve(3);
+    for(dataset_storage storage : storages)
+        sets.emplace_back(paths[0], paths[1], storage);
+
+    //Memory
+    const data_set& first = sets[0];
+    size_t raw = (size_t)first.size() * first.sample_size() + first.size();
+    cout << endl << first.size() << " samples of " << first.sample_size() << " pixels, "
+         << raw / 1048576.0 << " MB of pixels and labels" << endl;
+    for(int s = 0; s < 3; s++){
+        size_t bytes = sets[s].memory_size();
+        cout << names[s] << ": " << bytes / 1048576.0 << " MB in memory";
+        if(bytes > 0) cout << " (" << 100.0 * bytes / raw << "% of the pixels)";
+        cout << endl;
+    }
+
+    //Batches of samples spread over the whole dataset
+    int samples = first.size() / batch_size * batch_size;
+    if(samples == 0){
+        cerr << "Fewer samples than a batch" << endl;
+        return 1;
+    }
+    vector<int> order(samples);
+    for(int i = 0; i < samples; i++)
+        order[i] = (int)((i * 7919LL) % samples);
+
+    cout << endl << "load_batch of " << batch_size << " scattered samples, best of " << repeat
+         << " (samples/s, MB/s of pixels)" << endl;
+    byte_matrix batch(batch_size, first.sample_size());
+    size_t checksum = 0;
+    isa initial = kernels().type;
+    for(isa type : {isa::scalar, isa::sse2, isa::avx2, isa::avx512}){
+        if(!set_isa(type)) continue;
+
+        for(int s = 0; s < 3; s++){
+            double best = 1e30;
+            for(int r = 0; r < repeat; r++){
+                auto start = chrono::steady_clock::now();
+                for(int i = 0; i < samples; i += batch_size){
+                    sets[s].load_batch(order.data() + i, batch_size, batch);
+                    checksum += batch(0, first.sample_size() / 2);
+                }
+                best = min(best, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+            }
+            cout << isa_name(type) << " " << names[s] << ": " << (long long)(samples / best) << ", "
+                 << (long long)(samples * (double)first.sample_size() / best / 1e6) << endl;
+        }
+    }
+    set_isa(initial);
+
+    cout << "Checksum: " << checksum << endl;
+    return 0;
+}
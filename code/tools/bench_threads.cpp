@@ -0,0 +1,61 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "n_network.h"
+
+using namespace std;
+
+/**
+ * @brief Samples/s of learn for every number of threads from 1 to N
+ * @details bench_threads images.idx labels.idx [--threads N] [--batch B] [--epochs E]
+ * Trains the 784-32-16-10 network of main. Every batch is split among the threads and
+ * waits for them twice (gradients, then updates), so with the batches of 10 samples of main
+ * the joins weigh as much as the work; larger batches show the scaling of the computation
+ */
+int main(int argc, char** argv){
+    string paths[2];
+    int num_paths = 0, max_threads = 4, batch_size = 10, epochs = 1;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) max_threads = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc) batch_size = max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--epochs") == 0 && i + 1 < argc) epochs = max(1, atoi(argv[++i]));
+        else if(num_paths < 2) paths[num_paths++] = argv[i];
+    }
+    if(num_paths < 2){
+        cerr << "Usage: " << argv[0] << " images.idx labels.idx [--threads N] [--batch B] [--epochs E]" << endl;
+        return 1;
+    }
+
+    data_set dataset(paths[0], paths[1]);
+    double single = 0;
+
+    for(int threads = 1; threads <= max_threads; threads++){
+        srand(1);
+        n_network network(3, 28*28, 10, sig_activation, sig_activation);
+        network.set_layer_nodes(0, 32);
+        network.set_layer_nodes(1, 16);
+        network.set_input_scale(1.0 / 255);
+        network.set_threads(threads);
+
+        //The costs printed by learn are not part of the report
+        ostringstream quiet;
+        streambuf* previous = cout.rdbuf(quiet.rdbuf());
+        auto start = chrono::steady_clock::now();
+        network.learn(dataset, batch_size, 1, epochs);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout.rdbuf(previous);
+
+        double speed = (double)dataset.size() * epochs / seconds;
+        if(threads == 1) single = speed;
+        cout << threads << " thread" << (threads > 1 ? "s: " : ": ") << (long long)speed << " samples/s, "
+             << seconds << " s, speedup " << speed / single << "x" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include "aligned.h"
+#include "kernels.h"
+#include "matrix.h"
+
+using namespace std;
+
+/**
+ * @brief Hidden deltas the way they were computed before: walking each column of the weights
+ */
+static void column_walk(const matrix& a, const real* x, real* y){
+    for(int i = 0; i < a.get_cols(); i++){
+        accumulator aux = 0;
+        for(int j = 0; j < a.get_rows(); j++)
+            aux += x[j] * a(j, i);
+        y[i] = (real)aux;
+    }
+}
+
+/**
+ * @brief Best time of several runs of a function, in milliseconds
+ */
+template <class F>
+static double best_time(int repeat, F function){
+    double best = 1e30;
+    for(int r = 0; r < repeat; r++){
+        auto start = chrono::steady_clock::now();
+        function();
+        best = min(best, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+/**
+ * @brief Time of the hidden delta product y = a^T x: column walk against transposed_multiply
+ * @details bench_transpose [rows] [cols] [repeat], 1024 x 1024 by default. transposed_multiply
+ * runs with every instruction set the CPU supports
+ */
+int main(int argc, char** argv){
+    int rows = argc > 1 ? atoi(argv[1]) : 1024;
+    int cols = argc > 2 ? atoi(argv[2]) : rows;
+    int repeat = argc > 3 ? max(1, atoi(argv[3])) : 20;
+    if(rows <= 0 || cols <= 0){
+        cerr << "Usage: " << argv[0] << " [rows] [cols] [repeat]" << endl;
+        return 1;
+    }
+
+    //Random weights of the next layer and its deltas
+    srand(1);
+    matrix a(rows, cols);
+    aligned_vector<real> x(rows), expected(cols), y(cols);
+    for(int j = 0; j < rows; j++){
+        x[j] = (real)rand() / RAND_MAX - (real)0.5;
+        for(int i = 0; i < cols; i++)
+            a(j, i) = (real)rand() / RAND_MAX - (real)0.5;
+    }
+
+    cout << rows << "x" << cols << " weights, best of " << repeat << " (ms)" << endl;
+    cout << "column walk: " << best_time(repeat, [&]{column_walk(a, x.data(), expected.data());}) << endl;
+
+    isa initial = kernels().type;
+    for(isa type : {isa::scalar, isa::sse2, isa::avx2, isa::avx512}){
+        if(!set_isa(type)) continue;
+
+        double time = best_time(repeat, [&]{
+            transposed_multiply(a, array_view<const real>(x.data(), rows), array_view<real>(y.data(), cols));
+        });
+        double difference = 0;
+        for(int i = 0; i < cols; i++)
+            difference = max(difference, (double)fabs(y[i] - expected[i]));
+
+        cout << "transposed_multiply " << isa_name(type) << ": " << time
+             << " (largest difference " << difference << ")" << endl;
+    }
+    set_isa(initial);
+
+    return 0;
+}
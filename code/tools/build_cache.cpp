@@ -0,0 +1,54 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "dataset_cache.h"
+
+using namespace std;
+
+/**
+ * @brief Convert an IDX dataset into a dataset cache, or check an existing one
+ * @details build_cache images.idx labels.idx [cache] [--shard N] [--verify]
+ */
+int main(int argc, char** argv){
+    string paths[3];
+    int num_paths = 0, shard_samples = 8192;
+    bool verify_only = false;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "--verify") == 0) verify_only = true;
+        else if(strcmp(argv[i], "--shard") == 0 && i + 1 < argc) shard_samples = atoi(argv[++i]);
+        else if(num_paths < 3) paths[num_paths++] = argv[i];
+    }
+
+    if(num_paths < 2){
+        cerr << "Usage: " << argv[0] << " images.idx labels.idx [cache] [--shard N] [--verify]" << endl;
+        return 1;
+    }
+    string cache_path = num_paths == 3 ? paths[2] : dataset_cache::default_path(paths[0]);
+
+    try{
+        auto start = chrono::steady_clock::now();
+        if(!verify_only){
+            dataset_cache::build(paths[0], paths[1], cache_path, shard_samples);
+            cout << "Cache written: " << cache_path << " ("
+                 << chrono::duration<double>(chrono::steady_clock::now() - start).count() << " s)" << endl;
+        }
+
+        //Checksums of every shard, and whether the sources have changed since
+        if(!dataset_cache::verify(cache_path)){
+            cerr << "Damaged cache: " << cache_path << endl;
+            return 1;
+        }
+        cout << "Checksums: ok" << endl;
+        cout << "Sources: " << (dataset_cache::is_valid(cache_path, paths[0], paths[1]) ? "unchanged" : "changed")
+             << endl;
+    }
+    catch(const exception& e){
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}